@@ -0,0 +1,29 @@
+#include "AllocationTracking.h"
+#include "IROperator.h"
+#include <stdlib.h>
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+
+bool allocation_tracking_enabled() {
+    char *track = getenv("HL_TRACK_ALLOCATIONS");
+    return track && atoi(track) != 0;
+}
+
+Stmt inject_allocation_tracking(Stmt s, const string &pipeline_name) {
+    if (!allocation_tracking_enabled()) {
+        return s;
+    }
+
+    Expr name = pipeline_name;
+    Expr begin = Call::make(Int(32), "halide_allocation_tracking_begin", vec(name), Call::Extern);
+    Expr end = Call::make(Int(32), "halide_allocation_tracking_end", vec(name), Call::Extern);
+    s = Block::make(AssertStmt::make(begin == 0, "Failed to start tracking allocations"), s);
+    s = Block::make(s, AssertStmt::make(end == 0, "Failed to print allocation counters"));
+    return s;
+}
+
+}
+}
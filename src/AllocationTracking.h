@@ -0,0 +1,29 @@
+#ifndef HALIDE_ALLOCATION_TRACKING_H
+#define HALIDE_ALLOCATION_TRACKING_H
+
+/** \file
+ * Defines the lowering pass that reports heap allocations when
+ * allocation tracking is turned on
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Is allocation tracking turned on (by setting the environment
+ * variable HL_TRACK_ALLOCATIONS)? If so, CodeGen_Posix reports each
+ * heap allocation and free to the runtime, with the name of the
+ * buffer. Buffers that live in a scratch arena, or in the storage of
+ * another buffer, report their bytes under their own name too. */
+bool allocation_tracking_enabled();
+
+/** If allocation tracking is turned on, reset the runtime's
+ * allocation counters at the start of the pipeline, and print them
+ * at the end, in the same format as the profiler. */
+Stmt inject_allocation_tracking(Stmt s, const std::string &pipeline_name);
+
+}
+}
+
+#endif
@@ -0,0 +1,57 @@
+#include "AsyncTask.h"
+#include "Threads.h"
+
+namespace Halide {
+namespace Internal {
+
+struct AsyncTaskContents {
+    mutable RefCount ref_count;
+    AsyncWork *work;
+    Event done;
+
+    AsyncTaskContents(AsyncWork *w) : work(w) {}
+    ~AsyncTaskContents() {
+        delete work;
+    }
+};
+
+template<>
+EXPORT RefCount &ref_count<AsyncTaskContents>(const AsyncTaskContents *c) {return c->ref_count;}
+
+template<>
+EXPORT void destroy<AsyncTaskContents>(const AsyncTaskContents *c) {delete c;}
+
+namespace {
+void run_async_task(void *arg) {
+    // The background thread holds a reference, so the work outlives
+    // any handles on it that get dropped while it's running.
+    IntrusivePtr<AsyncTaskContents> *task = (IntrusivePtr<AsyncTaskContents> *)arg;
+    (*task).ptr->work->run();
+    (*task).ptr->done.set();
+    delete task;
+}
+}
+
+}
+
+AsyncTask::AsyncTask(Internal::AsyncWork *work) : contents(new Internal::AsyncTaskContents(work)) {
+    Internal::run_in_background(Internal::run_async_task,
+                                new Internal::IntrusivePtr<Internal::AsyncTaskContents>(contents));
+}
+
+bool AsyncTask::finished() const {
+    assert(defined() && "Can't check on an undefined AsyncTask");
+    return contents.ptr->done.test();
+}
+
+void AsyncTask::wait() const {
+    assert(defined() && "Can't wait on an undefined AsyncTask");
+    contents.ptr->done.wait();
+}
+
+Internal::AsyncWork *AsyncTask::work() const {
+    assert(defined() && "Can't get the work of an undefined AsyncTask");
+    return contents.ptr->work;
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef HALIDE_ASYNC_TASK_H
+#define HALIDE_ASYNC_TASK_H
+
+/** \file
+ * Defines a handle on work running on a background thread
+ */
+
+#include "IntrusivePtr.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Something to do on a background thread. Subclasses hold whatever
+ * the work needs, so that it stays alive until the work is done. */
+class AsyncWork {
+public:
+    virtual ~AsyncWork() {}
+    virtual void run() = 0;
+};
+
+struct AsyncTaskContents;
+
+}
+
+/** A handle on work started on a background thread by e.g. \ref
+ * Func::compile_jit_async or \ref Func::realize_async. The work
+ * carries on if every handle on it is dropped. */
+class AsyncTask {
+    Internal::IntrusivePtr<Internal::AsyncTaskContents> contents;
+public:
+    AsyncTask() {}
+
+    /** Start running some work on a background thread. Takes
+     * ownership of the work. */
+    EXPORT AsyncTask(Internal::AsyncWork *work);
+
+    /** Check if this handle refers to some work. */
+    bool defined() const {
+        return contents.defined();
+    }
+
+    /** Check if the work is done, without waiting for it. */
+    EXPORT bool finished() const;
+
+    /** Wait for the work to be done. */
+    EXPORT void wait() const;
+
+    /** Get the work this task ran. Only safe to look at once it has
+     * finished. */
+    EXPORT Internal::AsyncWork *work() const;
+};
+
+}
+
+#endif
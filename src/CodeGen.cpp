@@ -8,8 +8,10 @@
 #include "Deinterleave.h"
 #include "Simplify.h"
 #include "JITCompiledModule.h"
+#include "JITCache.h"
 #include "CodeGen_Internal.h"
 #include "Lerp.h"
+#include "Threads.h"
 
 #include <sstream>
 
@@ -87,14 +89,26 @@ CodeGen::CodeGen() :
     value(NULL),
     void_t(NULL), i1(NULL), i8(NULL), i16(NULL), i32(NULL), i64(NULL),
     f16(NULL), f32(NULL), f64(NULL),
-    buffer_t_type(NULL) {
+    buffer_t_type(NULL),
+    fast_compile(false) {
     initialize_llvm();
 }
 
 void CodeGen::initialize_llvm() {
+    // Pipelines may be compiled on several threads at once, and only
+    // one of them should do this.
+    static Mutex *mutex = new Mutex;
+    ScopedLock lock(*mutex);
+
     // Initialize the targets we want to generate code for which are enabled
     // in llvm configuration
     if (!llvm_initialized) {
+        #if LLVM_VERSION < 35
+        // Older llvms need telling that they'll be used from several
+        // threads, before anything else happens.
+        llvm_start_multithreaded();
+        #endif
+
         InitializeNativeTarget();
         InitializeNativeTargetAsmPrinter();
         InitializeNativeTargetAsmParser();
@@ -194,6 +208,25 @@ void CodeGen::compile(Stmt stmt, string name,
         }
     }
 
+    string wrapper_name = name + "_jit_wrapper";
+    FunctionType *wrapper_t = FunctionType::get(i32, vec<llvm::Type *>(i8->getPointerTo()->getPointerTo()), false);
+
+    jit_cached_object.clear();
+    if (!jit_cache_key.empty() && jit_cache_load(jit_cache_key, &jit_cached_object)) {
+        // The execution engine will load the cached object file
+        // instead of compiling the module, so the module only needs
+        // stand-ins for the functions we look up in it.
+        debug(1) << "Using cached object file for " << name << "\n";
+        module->setModuleIdentifier("halide_module_" + name);
+        llvm::Function *wrapper = llvm::Function::Create(wrapper_t, llvm::Function::ExternalLinkage, wrapper_name, module);
+        llvm::Function *stubs[] = {function, wrapper};
+        for (size_t i = 0; i < 2; i++) {
+            builder->SetInsertPoint(BasicBlock::Create(*context, "entry", stubs[i]));
+            builder->CreateRet(ConstantInt::get(i32, 0));
+        }
+        return;
+    }
+
 
     // Make the initial basic block
     BasicBlock *block = BasicBlock::Create(*context, "entry", function);
@@ -290,9 +323,7 @@ void CodeGen::compile(Stmt stmt, string name,
     verifyFunction(*function);
 
     // Now we need to make the wrapper function (useful for calling from jit)
-    string wrapper_name = name + "_jit_wrapper";
-    func_t = FunctionType::get(i32, vec<llvm::Type *>(i8->getPointerTo()->getPointerTo()), false);
-    llvm::Function *wrapper = llvm::Function::Create(func_t, llvm::Function::ExternalLinkage, wrapper_name, module);
+    llvm::Function *wrapper = llvm::Function::Create(wrapper_t, llvm::Function::ExternalLinkage, wrapper_name, module);
     block = BasicBlock::Create(*context, "entry", wrapper);
     builder->SetInsertPoint(block);
 
@@ -345,6 +376,11 @@ JITCompiledModule CodeGen::compile_to_function_pointers() {
 
 void CodeGen::optimize_module() {
 
+    if (!jit_cached_object.empty()) {
+        // There's no code in the module worth optimizing
+        return;
+    }
+
     debug(3) << "Optimizing module\n";
 
     FunctionPassManager function_pass_manager(module);
@@ -354,7 +390,7 @@ void CodeGen::optimize_module() {
     module_pass_manager.add(createAlwaysInlinerPass());
 
     PassManagerBuilder b;
-    b.OptLevel = 3;
+    b.OptLevel = fast_compile ? 0 : 3;
     b.populateFunctionPassManager(function_pass_manager);
     b.populateModulePassManager(module_pass_manager);
 
@@ -1260,6 +1296,8 @@ namespace {
 
 bool function_takes_user_context(const string &name) {
     static const char *user_context_runtime_funcs[] = {
+        "halide_allocation_tracking_begin",
+        "halide_allocation_tracking_end",
         "halide_copy_to_host",
         "halide_copy_to_dev",
         "halide_current_time_ns",
@@ -1278,7 +1316,9 @@ bool function_takes_user_context(const string &name) {
         "halide_profiling_timer",
         "halide_release",
         "halide_start_clock",
-        "halide_trace"
+        "halide_trace",
+        "halide_track_slice",
+        "halide_track_slice_free"
     };
     const int num_funcs = sizeof(user_context_runtime_funcs) /
         sizeof(user_context_runtime_funcs[0]);
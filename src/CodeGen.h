@@ -95,6 +95,31 @@ public:
 
     static void initialize_llvm();
 
+    /** Look for the native code in the jit cache under the given key
+     * (see JITCache.h) when compiling, and store it there after
+     * jitting if it wasn't found. Call this before calling
+     * compile. */
+    void set_jit_cache_key(const std::string &key) {jit_cache_key = key;}
+
+    /** The key set by set_jit_cache_key, and the object file found
+     * under it when compiling. If an object file was found, compile
+     * makes a module with stand-ins for the functions in it, and
+     * skips generating and optimizing code. */
+    // @{
+    const std::string &get_jit_cache_key() const {return jit_cache_key;}
+    const std::vector<char> &get_jit_cached_object() const {return jit_cached_object;}
+    // @}
+
+    /** Trade the speed of the generated code for the speed of
+     * generating it, by skipping llvm's optimization passes and
+     * using its quickest instruction selection. Used for the first
+     * tier of Func::compile_jit_tiered. Call this before calling
+     * compile. */
+    // @{
+    void set_fast_compile(bool f) {fast_compile = f;}
+    bool get_fast_compile() const {return fast_compile;}
+    // @}
+
 protected:
 
     /** State needed by llvm for code generation, including the
@@ -150,6 +175,15 @@ protected:
     /** The name of the function being generated. */
     std::string function_name;
 
+    /** See set_jit_cache_key */
+    // @{
+    std::string jit_cache_key;
+    std::vector<char> jit_cached_object;
+    // @}
+
+    /** See set_fast_compile */
+    bool fast_compile;
+
     /** Emit code that evaluates an expression, and return the llvm
      * representation of the result of the expression. */
     llvm::Value *codegen(Expr);
@@ -8,6 +8,7 @@
 #include <limits>
 #include <cmath>
 #include "Debug.h"
+#include "StackAllocation.h"
 #include "Lerp.h"
 
 namespace Halide {
@@ -735,6 +736,22 @@ void CodeGen_C::visit(const Select *op) {
 }
 
 void CodeGen_C::visit(const LetStmt *op) {
+    if (ends_with(op->name, ".arena_ptr")) {
+        // The address of an allocation within an arena. Taking the
+        // address of a Load in C would take the address of a
+        // temporary, so compute it from the arena and the offset.
+        const Call *call = op->value.as<Call>();
+        assert(call && call->name == Call::address_of);
+        const Load *load = call->args[0].as<Load>();
+        assert(load);
+        string offset = print_expr(load->index);
+        string alloc_name = op->name.substr(0, op->name.size() - string(".arena_ptr").size());
+        arena_slices.push(alloc_name, "((uint8_t *)" + print_name(load->name) + " + " + offset + ")");
+        op->body.accept(this);
+        arena_slices.pop(alloc_name);
+        return;
+    }
+
     string id_value = print_expr(op->value);
     Expr new_var = Variable::make(op->value.type(), id_value);
     Stmt body = substitute(op->name, new_var, op->body);
@@ -821,13 +838,21 @@ void CodeGen_C::visit(const Allocate *op) {
     do_indent();
     stream << print_type(op->type) << ' ';
 
-    // For sizes less than 8k, do a stack allocation
+    // For small sizes, or if asked to, do a stack allocation
     bool on_stack = false;
     if (const IntImm *sz = op->size.as<IntImm>()) {
-        on_stack = sz->value <= 8*1024;
+        on_stack = op->on_stack || sz->value * op->type.bytes() <= max_stack_allocation_bytes();
     }
 
-    if (on_stack) {
+    if (arena_slices.contains(op->name)) {
+        stream << "*"
+               << print_name(op->name)
+               << " = ("
+               << print_type(op->type)
+               << " *)"
+               << arena_slices.get(op->name)
+               << ";\n";
+    } else if (on_stack) {
         stream << print_name(op->name)
                << "[" << size_id << "];\n";
     } else {
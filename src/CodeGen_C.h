@@ -78,6 +78,10 @@ protected:
     /** Track which allocations actually went on the heap. */
     Scope<int> heap_allocations;
 
+    /** The addresses of allocations that are slices of a larger one
+     * (see inject_scratch_arenas). */
+    Scope<std::string> arena_slices;
+
     /** True if there is a void * __user_context parameter in the arguments. */
     bool have_user_context;
 
@@ -1,6 +1,13 @@
 #include "LLVM_Headers.h"
 #include "CodeGen_X86.h"
 #include "IROperator.h"
+#include "IRVisitor.h"
+#include "Bounds.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "CodeGen_GPU_Dev.h"
+#include "StackAllocation.h"
+#include "AllocationTracking.h"
 #include <iostream>
 #include "buffer_t.h"
 #include "IRPrinter.h"
@@ -129,9 +136,51 @@ void CodeGen_Posix::init_module() {
     f64x4 = VectorType::get(f64, 4);
 }
 
-CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &name, Type type, Expr size) {
+CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &name, Type type, Expr size, bool on_stack) {
 
     Allocation allocation;
+    allocation.in_arena = false;
+    allocation.tracked_bytes = NULL;
+
+    llvm::Type *llvm_type = llvm_type_of(type);
+
+    if (sym_exists(name + ".arena_ptr")) {
+        // This allocation has been given a slice of a larger one by
+        // inject_scratch_arenas. It gets freed along with the arena.
+        allocation.stack_size = 0;
+        allocation.in_arena = true;
+        allocation.ptr = builder->CreatePointerCast(sym_get(name + ".arena_ptr"),
+                                                    llvm_type->getPointerTo());
+        if (allocation_tracking_enabled()) {
+            // The arena is tracked as one heap allocation, so report
+            // this buffer's part of it under its own name.
+            allocation.tracked_bytes = track_malloc(name, codegen(size * type.bytes()),
+                                                    "halide_track_slice");
+        }
+        debug(3) << "Pushing allocation called " << name << ".host onto the symbol table\n";
+        allocations.push(name, allocation);
+        return allocation;
+    }
+
+    if (sym_exists(name + ".scratch_pool")) {
+        // We're in a task of a parallel for loop, which made a pool
+        // for this allocation before it started.
+        Value *pool = sym_get(name + ".scratch_pool");
+        llvm::Function *acquire_fn = module->getFunction("halide_scratch_acquire");
+        assert(acquire_fn && "Could not find halide_scratch_acquire in module");
+        debug(4) << "Creating call to halide_scratch_acquire\n";
+        Value *args[2] = { get_user_context(), pool };
+        allocation.stack_size = 0;
+        allocation.ptr = builder->CreateCall(acquire_fn, args);
+        create_assertion(builder->CreateIsNotNull(allocation.ptr),
+                         "Out of memory (malloc returned NULL)");
+        if (allocation_tracking_enabled()) {
+            allocation.tracked_bytes = track_malloc(name, codegen(size * type.bytes()));
+        }
+        debug(3) << "Pushing allocation called " << name << ".host onto the symbol table\n";
+        allocations.push(name, allocation);
+        return allocation;
+    }
 
     if (const IntImm *int_size = size.as<IntImm>()) {
         int stack_elems = int_size->value;
@@ -141,16 +190,15 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
         // Round up to nearest multiple of 32.
         allocation.stack_size = ((allocation.stack_size + 31)/32)*32;
 
-        // If it's more than 8k, put it on the heap.
-        if (allocation.stack_size > 8*1024) {
+        // If it's too big, put it on the heap, unless it was asked to
+        // go on the stack.
+        if (allocation.stack_size > max_stack_allocation_bytes() && !on_stack) {
             allocation.stack_size = 0;
         }
     } else {
         allocation.stack_size = 0;
     }
 
-    llvm::Type *llvm_type = llvm_type_of(type);
-
     if (allocation.stack_size) {
 
         // We used to do the alloca locally and save and restore the
@@ -180,6 +228,10 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
         // Assert that the allocation worked.
         create_assertion(builder->CreateIsNotNull(allocation.ptr),
                          "Out of memory (malloc returned NULL)");
+
+        if (allocation_tracking_enabled()) {
+            allocation.tracked_bytes = track_malloc(name, llvm_size);
+        }
     }
 
     // Push the allocation base pointer onto the symbol table
@@ -195,19 +247,55 @@ void CodeGen_Posix::free_allocation(const std::string &name) {
 
     assert(alloc.ptr);
 
+    Instruction *inst = dyn_cast<Instruction>(alloc.ptr);
     CallInst *call_inst = dyn_cast<CallInst>(alloc.ptr);
-    llvm::Function *allocated_in = call_inst ? call_inst->getParent()->getParent() : NULL;
+    llvm::Function *allocated_in = inst ? inst->getParent()->getParent() : NULL;
     llvm::Function *current_func = builder->GetInsertBlock()->getParent();
 
     if (alloc.stack_size) {
         // Free is a no-op for stack allocations
-    } else if (allocated_in == current_func) { // Skip over allocations from outside this function.
-        // Call free
-        llvm::Function *free_fn = module->getFunction("halide_free");
-        assert(free_fn && "Could not find halide_free in module");
-        debug(4) << "Creating call to halide_free\n";
-        Value *args[2] = { get_user_context(), alloc.ptr };
-        builder->CreateCall(free_fn, args);
+    } else if (alloc.in_arena) {
+        // Slices of arenas get freed along with the arena, but they
+        // may have been reported to the allocation tracker.
+        if (alloc.tracked_bytes && allocated_in == current_func) {
+            llvm::Function *track_fn = module->getFunction("halide_track_slice_free");
+            assert(track_fn && "Could not find halide_track_slice_free in module");
+            debug(4) << "Creating call to halide_track_slice_free\n";
+            Value *args[3] = { get_user_context(), create_string_constant(name), alloc.tracked_bytes };
+            builder->CreateCall(track_fn, args);
+        }
+    } else if (call_inst && allocated_in == current_func) {
+        // Skip over allocations from outside this function.
+        if (alloc.tracked_bytes) {
+            llvm::Function *track_fn = module->getFunction("halide_track_free");
+            assert(track_fn && "Could not find halide_track_free in module");
+            debug(4) << "Creating call to halide_track_free\n";
+            Value *args[3] = { get_user_context(), create_string_constant(name), alloc.tracked_bytes };
+            builder->CreateCall(track_fn, args);
+        }
+
+        llvm::Function *called = call_inst->getCalledFunction();
+        if (called && called->getName() == "halide_scratch_acquire") {
+            // Give the block back to the pool it came from
+            llvm::Function *release_fn = module->getFunction("halide_scratch_release");
+            assert(release_fn && "Could not find halide_scratch_release in module");
+            debug(4) << "Creating call to halide_scratch_release\n";
+            Value *args[3] = { get_user_context(), call_inst->getArgOperand(1), alloc.ptr };
+            builder->CreateCall(release_fn, args);
+        } else if (called && called->getName() == "halide_scratch_pool_create") {
+            llvm::Function *destroy_fn = module->getFunction("halide_scratch_pool_destroy");
+            assert(destroy_fn && "Could not find halide_scratch_pool_destroy in module");
+            debug(4) << "Creating call to halide_scratch_pool_destroy\n";
+            Value *args[2] = { get_user_context(), alloc.ptr };
+            builder->CreateCall(destroy_fn, args);
+        } else {
+            // Call free
+            llvm::Function *free_fn = module->getFunction("halide_free");
+            assert(free_fn && "Could not find halide_free in module");
+            debug(4) << "Creating call to halide_free\n";
+            Value *args[2] = { get_user_context(), alloc.ptr };
+            builder->CreateCall(free_fn, args);
+        }
     }
 
     allocations.pop(name);
@@ -217,6 +305,25 @@ void CodeGen_Posix::destroy_allocation(Allocation alloc) {
     // Heap allocations have already been freed.
 }
 
+Value *CodeGen_Posix::track_malloc(const std::string &name, Value *bytes,
+                                   const std::string &track_fn_name) {
+    llvm::Function *track_fn = module->getFunction(track_fn_name);
+    if (!track_fn) {
+        std::cerr << "Could not find " << track_fn_name << " in module\n";
+        assert(false);
+    }
+
+    llvm::Function::arg_iterator arg_iter = track_fn->arg_begin();
+    ++arg_iter;  // skip the user context *
+    ++arg_iter;  // skip the name
+    bytes = builder->CreateIntCast(bytes, arg_iter->getType(), false);
+
+    debug(4) << "Creating call to " << track_fn_name << "\n";
+    Value *args[3] = { get_user_context(), create_string_constant(name), bytes };
+    builder->CreateCall(track_fn, args);
+    return bytes;
+}
+
 void CodeGen_Posix::visit(const Allocate *alloc) {
 
     if (sym_exists(alloc->name + ".host")) {
@@ -225,7 +332,7 @@ void CodeGen_Posix::visit(const Allocate *alloc) {
         assert(false);
     }
 
-    Allocation allocation = create_allocation(alloc->name, alloc->type, alloc->size);
+    Allocation allocation = create_allocation(alloc->name, alloc->type, alloc->size, alloc->on_stack);
     sym_push(alloc->name + ".host", allocation.ptr);
 
     codegen(alloc->body);
@@ -243,6 +350,130 @@ void CodeGen_Posix::visit(const Free *stmt) {
     sym_pop(stmt->name + ".host");
 }
 
+namespace {
+
+// Find the heap allocations made once per iteration of the body of a
+// parallel for loop, i.e. not inside some inner loop, and how many
+// bytes they need in terms of the loop variable and things defined
+// outside the loop.
+class FindTaskAllocations : public IRVisitor {
+public:
+    vector<pair<string, Expr> > allocations;
+    bool has_gpu_loop;
+
+    FindTaskAllocations() : has_gpu_loop(false), loop_depth(0) {}
+
+private:
+    using IRVisitor::visit;
+
+    int loop_depth;
+
+    // The lets between the top of the loop body and the current
+    // statement, innermost last.
+    vector<pair<string, Expr> > lets;
+
+    void visit(const For *op) {
+        has_gpu_loop = has_gpu_loop || CodeGen_GPU_Dev::is_gpu_var(op->name);
+        loop_depth++;
+        IRVisitor::visit(op);
+        loop_depth--;
+    }
+
+    void visit(const LetStmt *op) {
+        lets.push_back(make_pair(op->name, op->value));
+        op->body.accept(this);
+        lets.pop_back();
+    }
+
+    void visit(const Allocate *op) {
+        op->body.accept(this);
+
+        if (loop_depth > 0) return;
+
+        Expr bytes = op->size * op->type.bytes();
+        bool in_arena = false;
+        for (size_t i = lets.size(); i > 0; i--) {
+            bytes = substitute(lets[i-1].first, lets[i-1].second, bytes);
+            in_arena = in_arena || (lets[i-1].first == op->name + ".arena_ptr");
+        }
+
+        // Small constant-sized allocations go on the stack, and slices
+        // of arenas don't need memory of their own.
+        const IntImm *const_bytes = bytes.as<IntImm>();
+        if ((const_bytes && const_bytes->value <= max_stack_allocation_bytes()) ||
+            op->on_stack || in_arena) {
+            return;
+        }
+
+        if (!reads_memory(bytes)) {
+            allocations.push_back(make_pair(op->name, bytes));
+        }
+    }
+};
+
+}
+
+void CodeGen_Posix::visit(const For *op) {
+    if (op->for_type != For::Parallel) {
+        CodeGen::visit(op);
+        return;
+    }
+
+    FindTaskAllocations find;
+    op->body.accept(&find);
+    if (find.has_gpu_loop) {
+        CodeGen::visit(op);
+        return;
+    }
+
+    Scope<Interval> scope;
+    scope.push(op->name, Interval(op->min, op->min + op->extent - 1));
+
+    Stmt body = op->body;
+    vector<string> pools;
+    for (size_t i = 0; i < find.allocations.size(); i++) {
+        const string &name = find.allocations[i].first;
+        Expr bytes = bounds_of_expr_in_scope(find.allocations[i].second, scope).max;
+        if (!bytes.defined()) continue;
+        bytes = simplify(bytes);
+
+        llvm::Function *create_fn = module->getFunction("halide_scratch_pool_create");
+        assert(create_fn && "Could not find halide_scratch_pool_create in module");
+
+        llvm::Function::arg_iterator arg_iter = create_fn->arg_begin();
+        ++arg_iter;  // skip the user context *
+        Value *llvm_size = builder->CreateIntCast(codegen(bytes), arg_iter->getType(), false);
+
+        debug(4) << "Creating call to halide_scratch_pool_create\n";
+        Value *args[2] = { get_user_context(), llvm_size };
+        Allocation pool = { builder->CreateCall(create_fn, args), 0 };
+        create_assertion(builder->CreateIsNotNull(pool.ptr),
+                         "Out of memory (malloc returned NULL)");
+
+        debug(3) << "Making a scratch pool of " << bytes << " byte blocks for " << name << "\n";
+        allocations.push(name + ".scratch_pool", pool);
+        sym_push(name + ".scratch_pool", pool.ptr);
+
+        // Refer to the pool in the loop body, so that it gets passed
+        // to the tasks in the closure.
+        Expr pool_var = Variable::make(Handle(), name + ".scratch_pool");
+        body = LetStmt::make(name + ".scratch_pool", pool_var, body);
+        pools.push_back(name + ".scratch_pool");
+    }
+
+    if (pools.empty()) {
+        CodeGen::visit(op);
+        return;
+    }
+
+    CodeGen::visit(For::make(op->name, op->min, op->extent, op->for_type, body));
+
+    for (size_t i = pools.size(); i > 0; i--) {
+        free_allocation(pools[i-1]);
+        sym_pop(pools[i-1]);
+    }
+}
+
 void CodeGen_Posix::prepare_for_early_exit() {
     // We've jumped to a code path that will be called just before
     // bailing out. Free everything outstanding.
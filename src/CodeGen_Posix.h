@@ -51,14 +51,23 @@ protected:
 
     using CodeGen::visit;
 
-    /** Posix implementation of Allocate. Small constant-sized allocations go
-     * on the stack. The rest go on the heap by calling "halide_malloc"
+    /** Posix implementation of Allocate. Small constant-sized
+     * allocations, and constant-sized allocations marked as being on
+     * the stack, go on the stack. The rest go on the heap by calling "halide_malloc"
      * and "halide_free" in the standard library. */
     // @{
     void visit(const Allocate *);
     void visit(const Free *);
     // @}
 
+    /** Parallel for loops get a scratch pool for each heap allocation
+     * made once per iteration of their body, created before the loop
+     * and destroyed after it. Each task takes its block from the pool
+     * and gives it back when done, so the memory is reused by every
+     * task a worker thread runs, rather than being allocated and freed
+     * each time. */
+    void visit(const For *);
+
     /** A struct describing heap or stack allocations. */
     struct Allocation {
         llvm::Value *ptr;
@@ -66,6 +75,17 @@ protected:
         /** How many bytes of stack space used. 0 implies it was a
          * heap allocation. */
         int stack_size;
+
+        /** Whether this is a slice of a scratch arena made by
+         * inject_scratch_arenas, which gets freed along with the
+         * arena. */
+        bool in_arena;
+
+        /** The size in bytes reported to halide_track_malloc (or
+         * halide_track_slice for slices of arenas), or NULL if
+         * allocation tracking is off or this wasn't a heap
+         * allocation. See AllocationTracking.h */
+        llvm::Value *tracked_bytes;
     };
 
     /** The allocations currently in scope. The stack gets pushed when
@@ -79,13 +99,17 @@ protected:
      * free_stack_blocks list, or it saves the stack pointer and calls
      * alloca.
      *
+     * Inside a parallel for loop with a scratch pool for the
+     * allocation (see visit(const For *)), it instead takes a block
+     * from the pool.
+     *
      * This call returns the allocation, pushes it onto the
      * 'allocations' map, and adds an entry to the symbol table called
      * name.host that provides the base pointer.
      *
      * When the allocation can be freed call 'free_allocation', and
      * when it goes out of scope call 'destroy_allocation'. */
-    Allocation create_allocation(const std::string &name, Type type, Expr size);
+    Allocation create_allocation(const std::string &name, Type type, Expr size, bool on_stack = false);
 
     /** Free the memory backing an allocation and pop it from the
      * symbol table and the allocations map. For heap allocations it
@@ -98,6 +122,14 @@ protected:
      * stack removes the entry from the free_stack_blocks list. */
     void destroy_allocation(Allocation alloc);
 
+    /** Report a heap allocation of the given number of bytes to the
+     * runtime's allocation tracker, and return the size as passed, so
+     * that the matching free can report it too. The name of the
+     * runtime function to call can be given, to report slices of
+     * arenas with halide_track_slice instead. */
+    llvm::Value *track_malloc(const std::string &name, llvm::Value *bytes,
+                              const std::string &track_fn_name = "halide_track_malloc");
+
     /** Free all heap allocations in scope. */
     void prepare_for_early_exit();
 
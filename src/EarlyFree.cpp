@@ -159,22 +159,33 @@ class InjectEarlyFrees : public IRMutator {
         alloc = stmt.as<Allocate>();
         assert(alloc);
 
-        FindLastUse last_use(alloc->name);
-        stmt.accept(&last_use);
-
-        if (last_use.last_use.defined()) {
-            InjectMarker inject_marker;
-            inject_marker.func = alloc->name;
-            inject_marker.last_use = last_use.last_use;
-            stmt = inject_marker.mutate(stmt);
+        Stmt marked = inject_free_marker(stmt, alloc->name);
+
+        if (!marked.same_as(stmt)) {
+            stmt = marked;
         } else {
             stmt = Allocate::make(alloc->name, alloc->type, alloc->size,
-                                Block::make(alloc->body, Free::make(alloc->name)));
+                                  Block::make(alloc->body, Free::make(alloc->name)),
+                                  alloc->on_stack);
         }
 
     }
 };
 
+Stmt inject_free_marker(Stmt s, const string &buffer) {
+    FindLastUse last_use(buffer);
+    s.accept(&last_use);
+
+    if (last_use.last_use.defined()) {
+        InjectMarker inject_marker;
+        inject_marker.func = buffer;
+        inject_marker.last_use = last_use.last_use;
+        return inject_marker.mutate(s);
+    } else {
+        return s;
+    }
+}
+
 Stmt inject_early_frees(Stmt s) {
     InjectEarlyFrees early_frees;
     return early_frees.mutate(s);
@@ -18,6 +18,12 @@ namespace Internal {
  * close of their Allocate node. */
 Stmt inject_early_frees(Stmt s);
 
+/** Inject a single marker (a Free node) for the named buffer just
+ * after its last use in the given statement. Returns the statement
+ * unchanged if the buffer isn't used. Other passes can use this to
+ * find out which statements run after a buffer is dead. */
+Stmt inject_free_marker(Stmt s, const std::string &buffer);
+
 }
 }
 
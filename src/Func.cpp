@@ -7,6 +7,8 @@
 #include "Argument.h"
 #include "Lower.h"
 #include "StmtCompiler.h"
+#include "JITCache.h"
+#include "JITModuleCache.h"
 #include "CodeGen_C.h"
 #include "Image.h"
 #include "Param.h"
@@ -16,6 +18,7 @@
 #include <iostream>
 #include <string.h>
 #include <fstream>
+#include <sstream>
 
 namespace Halide {
 
@@ -26,6 +29,7 @@ using std::string;
 using std::vector;
 using std::pair;
 using std::ofstream;
+using std::map;
 
 using namespace Internal;
 
@@ -35,7 +39,10 @@ Func::Func(const string &name) : func(unique_name(name)),
                                  custom_free(NULL),
                                  custom_do_par_for(NULL),
                                  custom_do_task(NULL),
-                                 custom_trace(NULL) {
+                                 custom_trace(NULL),
+                                 max_param_variants(0),
+                                 found_scalar_params(false),
+                                 jit_code_shared(false) {
 }
 
 Func::Func() : func(unique_name('f')),
@@ -44,7 +51,10 @@ Func::Func() : func(unique_name('f')),
                custom_free(NULL),
                custom_do_par_for(NULL),
                custom_do_task(NULL),
-               custom_trace(NULL) {
+               custom_trace(NULL),
+               max_param_variants(0),
+               found_scalar_params(false),
+               jit_code_shared(false) {
 }
 
 Func::Func(Expr e) : func(unique_name('f')),
@@ -53,7 +63,10 @@ Func::Func(Expr e) : func(unique_name('f')),
                      custom_free(NULL),
                      custom_do_par_for(NULL),
                      custom_do_task(NULL),
-                     custom_trace(NULL) {
+                     custom_trace(NULL),
+                     max_param_variants(0),
+                     found_scalar_params(false),
+                     jit_code_shared(false) {
     (*this)(_) = e;
 }
 
@@ -1042,6 +1055,11 @@ Func &Func::compute_inline() {
     return *this;
 }
 
+Func &Func::store_in_stack() {
+    func.schedule().store_in_stack = true;
+    return *this;
+}
+
 Func &Func::trace_loads() {
     func.trace_loads();
     return *this;
@@ -1065,6 +1083,10 @@ ScheduleHandle Func::update(int idx) {
     return ScheduleHandle(func.reduction_schedule(idx));
 }
 
+ScheduleHandle Func::specialize(Expr condition) {
+    return ScheduleHandle(func.add_specialization(condition));
+}
+
 FuncRefVar::FuncRefVar(Internal::Function f, const vector<Var> &a, int placeholder_pos) : func(f) {
     implicit_placeholder_pos = placeholder_pos;
     args.resize(a.size());
@@ -1425,6 +1447,7 @@ public:
     vector<const void *> arg_values;
     vector<pair<int, Internal::Parameter> > image_param_args;
     vector<pair<int, Buffer> > image_args;
+    vector<Internal::Parameter> scalar_params;
 
     InferArguments(const string &o) : output(o) {}
 
@@ -1461,6 +1484,7 @@ private:
             }
         } else {
             arg_values.push_back(p.get_scalar_address());
+            scalar_params.push_back(p);
         }
     }
 
@@ -1691,8 +1715,26 @@ void Func::compile_to_assembly(const string &filename, vector<Argument> args, co
     compile_to_assembly(filename, args, "", target);
 }
 
+bool Func::has_custom_handlers() const {
+    return (error_handler || custom_malloc || custom_free ||
+            custom_do_par_for || custom_do_task || custom_trace);
+}
+
+void Func::stop_sharing_jit_code() {
+    if (!jit_code_shared || !has_custom_handlers()) return;
+    Internal::debug(1) << "Dropping the jit-compiled code for " << name()
+                       << ", which may be shared with other Funcs, because it has custom handlers\n";
+    compiled_module = JITCompiledModule();
+    arg_values.clear();
+    image_param_args.clear();
+    param_variants.clear();
+    pending_optimized = AsyncTask();
+    jit_code_shared = false;
+}
+
 void Func::set_error_handler(void (*handler)(void *, const char *)) {
     error_handler = handler;
+    stop_sharing_jit_code();
     if (compiled_module.set_error_handler) {
         compiled_module.set_error_handler(handler);
     }
@@ -1702,6 +1744,7 @@ void Func::set_custom_allocator(void *(*cust_malloc)(void *, size_t),
                                 void (*cust_free)(void *, void *)) {
     custom_malloc = cust_malloc;
     custom_free = cust_free;
+    stop_sharing_jit_code();
     if (compiled_module.set_custom_allocator) {
         compiled_module.set_custom_allocator(cust_malloc, cust_free);
     }
@@ -1709,6 +1752,7 @@ void Func::set_custom_allocator(void *(*cust_malloc)(void *, size_t),
 
 void Func::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *, int, uint8_t *), int, int, uint8_t *)) {
     custom_do_par_for = cust_do_par_for;
+    stop_sharing_jit_code();
     if (compiled_module.set_custom_do_par_for) {
         compiled_module.set_custom_do_par_for(cust_do_par_for);
     }
@@ -1716,6 +1760,7 @@ void Func::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *,
 
 void Func::set_custom_do_task(int (*cust_do_task)(void *, int (*)(void *, int, uint8_t *), int, uint8_t *)) {
     custom_do_task = cust_do_task;
+    stop_sharing_jit_code();
     if (compiled_module.set_custom_do_task) {
         compiled_module.set_custom_do_task(cust_do_task);
     }
@@ -1723,6 +1768,7 @@ void Func::set_custom_do_task(int (*cust_do_task)(void *, int (*)(void *, int, u
 
 void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
     custom_trace = t;
+    stop_sharing_jit_code();
     if (compiled_module.set_custom_trace) {
         compiled_module.set_custom_trace(t);
     }
@@ -1733,9 +1779,22 @@ void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
 }
 
   void Func::realize(Realization dst, const Target &target) {
-    if (!compiled_module.wrapped_function) compile_jit(target);
+    finish_async_compile();
+    use_optimized_code_if_ready();
 
-    assert(compiled_module.wrapped_function);
+    ParamVariant *variant = NULL;
+    if (max_param_variants > 0) {
+        variant = get_param_variant(target);
+    }
+    if (!variant && !compiled_module.wrapped_function) compile_jit(target);
+
+    // The code to run, and its arguments
+    JITCompiledModule &module = variant ? variant->module : compiled_module;
+    vector<const void *> &args = variant ? variant->arg_values : arg_values;
+    const vector<pair<int, Internal::Parameter> > &image_args =
+        variant ? variant->image_param_args : image_param_args;
+
+    assert(module.wrapped_function);
 
     // Check the type and dimensionality of the buffer
     for (size_t i = 0; i < dst.size(); i++) {
@@ -1743,6 +1802,62 @@ void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
         assert(dst[i].type() == func.output_types()[i] && "Buffer and Func have different element types");
     }
 
+    // In case these have changed since the last realization
+    module.set_error_handler(error_handler);
+    module.set_custom_allocator(custom_malloc, custom_free);
+    module.set_custom_do_par_for(custom_do_par_for);
+    module.set_custom_do_task(custom_do_task);
+    module.set_custom_trace(custom_trace);
+
+    // Update the address of the buffers we're realizing into
+    for (size_t i = 0; i < dst.size(); i++) {
+        args[args.size()-dst.size()+i] = dst[i].raw_buffer();
+    }
+
+    // Update the addresses of the image param args
+    Internal::debug(3) << image_args.size() << " image param args to set\n";
+    for (size_t i = 0; i < image_args.size(); i++) {
+        Internal::debug(3) << "Updating address for image param: " << image_args[i].second.name() << "\n";
+        Buffer b = image_args[i].second.get_buffer();
+        assert(b.defined() && "An ImageParam is not bound to a buffer");
+        args[image_args[i].first] = b.raw_buffer();
+    }
+
+    for (size_t i = 0; i < args.size(); i++) {
+        Internal::debug(2) << "Arg " << i << " = " << args[i] << "\n";
+        assert(args[i] != NULL && "An argument to a jitted function is null\n");
+    }
+
+    Internal::debug(2) << "Calling jitted function\n";
+    int exit_status = module.wrapped_function(&(args[0]));
+    Internal::debug(2) << "Back from jitted function. Exit status was " << exit_status << "\n";
+
+    for (size_t i = 0; i < dst.size(); i++) {
+        dst[i].set_source_module(module);
+    }
+}
+
+void Func::realize_batch(const vector<Buffer> &outputs, const vector<ImageParam> &params,
+                         const vector<vector<Buffer> > &inputs, const Target &target) {
+    vector<Realization> dst;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        dst.push_back(Realization(vec<Buffer>(outputs[i])));
+    }
+    realize_batch(dst, params, inputs, target);
+}
+
+void Func::realize_batch(const vector<Realization> &outputs, const vector<ImageParam> &params,
+                         const vector<vector<Buffer> > &inputs, const Target &target) {
+    assert(defined() && "Can't realize undefined function");
+    assert(outputs.size() == inputs.size() && "realize_batch needs one list of inputs per output");
+    if (outputs.empty()) return;
+
+    finish_async_compile();
+    use_optimized_code_if_ready();
+    if (!compiled_module.wrapped_function) compile_jit(target);
+
+    assert(compiled_module.wrapped_function && compiled_module.do_batch);
+
     // In case these have changed since the last realization
     compiled_module.set_error_handler(error_handler);
     compiled_module.set_custom_allocator(custom_malloc, custom_free);
@@ -1750,32 +1865,223 @@ void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
     compiled_module.set_custom_do_task(custom_do_task);
     compiled_module.set_custom_trace(custom_trace);
 
-    // Update the address of the buffers we're realizing into
-    for (size_t i = 0; i < dst.size(); i++) {
-        arg_values[arg_values.size()-dst.size()+i] = dst[i].raw_buffer();
+    // The arguments that are the same for every item
+    vector<const void *> common = arg_values;
+    for (size_t i = 0; i < image_param_args.size(); i++) {
+        Buffer b = image_param_args[i].second.get_buffer();
+        if (b.defined()) {
+            common[image_param_args[i].first] = b.raw_buffer();
+        }
     }
 
-    // Update the addresses of the image param args
-    Internal::debug(3) << image_param_args.size() << " image param args to set\n";
+    // Where each of the given ImageParams goes in the argument list,
+    // or -1 if the pipeline doesn't use it.
+    vector<int> param_slots(params.size(), -1);
+    for (size_t j = 0; j < params.size(); j++) {
+        for (size_t k = 0; k < image_param_args.size(); k++) {
+            if (image_param_args[k].second.name() == params[j].name()) {
+                param_slots[j] = image_param_args[k].first;
+            }
+        }
+    }
+
+    // Lay out an argument list per item
+    size_t num_args = arg_values.size();
+    size_t num_outputs = func.outputs();
+    vector<const void *> args(outputs.size() * num_args);
+    vector<const void **> arg_lists(outputs.size());
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const void **item = &args[i * num_args];
+        std::copy(common.begin(), common.end(), item);
+
+        assert(inputs[i].size() == params.size() && "realize_batch needs one input buffer per ImageParam per item");
+        for (size_t j = 0; j < params.size(); j++) {
+            assert(inputs[i][j].type() == params[j].type() && "Buffer and ImageParam have different element types");
+            if (param_slots[j] >= 0) {
+                item[param_slots[j]] = inputs[i][j].raw_buffer();
+            }
+        }
+
+        const Realization &dst = outputs[i];
+        assert(dst.size() == num_outputs && "Wrong number of output buffers");
+        for (size_t k = 0; k < num_outputs; k++) {
+            assert(dst[k].dimensions() == dimensions() && "Buffer and Func have different dimensionalities");
+            assert(dst[k].type() == func.output_types()[k] && "Buffer and Func have different element types");
+            item[num_args - num_outputs + k] = dst[k].raw_buffer();
+        }
+
+        for (size_t a = 0; a < num_args; a++) {
+            assert(item[a] != NULL && "An argument to a jitted function is null\n");
+        }
+        arg_lists[i] = item;
+    }
+
+    Internal::debug(2) << "Calling jitted function on a batch of " << outputs.size() << "\n";
+    int exit_status = compiled_module.do_batch(NULL, compiled_module.wrapped_function,
+                                               &(arg_lists[0]), (int)outputs.size());
+    Internal::debug(2) << "Back from jitted function. Exit status was " << exit_status << "\n";
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        for (size_t k = 0; k < num_outputs; k++) {
+            outputs[i][k].set_source_module(compiled_module);
+        }
+    }
+}
+
+BoundCall Func::bind(const Target &target) {
+    assert(defined() && "Can't bind undefined function");
+    finish_async_compile();
+    use_optimized_code_if_ready();
+    if (!compiled_module.wrapped_function) compile_jit(target);
+
+    assert(compiled_module.wrapped_function);
+
+    compiled_module.set_error_handler(error_handler);
+    compiled_module.set_custom_allocator(custom_malloc, custom_free);
+    compiled_module.set_custom_do_par_for(custom_do_par_for);
+    compiled_module.set_custom_do_task(custom_do_task);
+    compiled_module.set_custom_trace(custom_trace);
+
+    BoundCall call;
+    call.module = compiled_module;
+    call.arg_values = arg_values;
+    call.image_param_args = image_param_args;
+    call.buffers.resize(arg_values.size());
+    call.output_types = func.output_types();
+    call.output_dimensions = dimensions();
+
     for (size_t i = 0; i < image_param_args.size(); i++) {
-        Internal::debug(3) << "Updating address for image param: " << image_param_args[i].second.name() << "\n";
         Buffer b = image_param_args[i].second.get_buffer();
-        assert(b.defined() && "An ImageParam is not bound to a buffer");
-        arg_values[image_param_args[i].first] = b.raw_buffer();
+        int idx = image_param_args[i].first;
+        if (b.defined()) {
+            call.arg_values[idx] = b.raw_buffer();
+            call.buffers[idx] = b;
+        } else {
+            call.arg_values[idx] = NULL;
+            call.unbound_args++;
+        }
     }
 
-    for (size_t i = 0; i < arg_values.size(); i++) {
-        Internal::debug(2) << "Arg " << i << " = " << arg_values[i] << "\n";
-        assert(arg_values[i] != NULL && "An argument to a jitted function is null\n");
+    // No outputs until set_output
+    for (size_t i = arg_values.size() - call.output_types.size(); i < arg_values.size(); i++) {
+        call.arg_values[i] = NULL;
+        call.unbound_args++;
     }
 
-    Internal::debug(2) << "Calling jitted function\n";
-    int exit_status = compiled_module.wrapped_function(&(arg_values[0]));
-    Internal::debug(2) << "Back from jitted function. Exit status was " << exit_status << "\n";
+    if (pending_optimized.defined()) {
+        call.tiered_source = *this;
+    }
+
+    return call;
+}
 
+void BoundCall::set_arg(size_t idx, Buffer b) {
+    if (arg_values[idx] == NULL) {
+        unbound_args--;
+    }
+    arg_values[idx] = b.raw_buffer();
+    buffers[idx] = b;
+}
+
+void BoundCall::set_output_buffer(size_t i, Buffer dst) {
+    assert(dst.dimensions() == output_dimensions && "Buffer and Func have different dimensionalities");
+    assert(dst.type() == output_types[i] && "Buffer and Func have different element types");
+    size_t idx = arg_values.size() - output_types.size() + i;
+    // Most callers realize into the same few buffers over and over
+    if (!dst.same_as(buffers[idx])) {
+        set_arg(idx, dst);
+        dst.set_source_module(module);
+    }
+}
+
+void BoundCall::set_output(Buffer dst) {
+    assert(defined() && "Can't set the output of an unbound BoundCall");
+    assert(output_types.size() == 1 && "Wrong number of output buffers");
+    set_output_buffer(0, dst);
+}
+
+void BoundCall::set_output(Realization dst) {
+    assert(defined() && "Can't set the output of an unbound BoundCall");
+    assert(dst.size() == output_types.size() && "Wrong number of output buffers");
     for (size_t i = 0; i < dst.size(); i++) {
-        dst[i].set_source_module(compiled_module);
+        set_output_buffer(i, dst[i]);
+    }
+}
+
+void BoundCall::set_input(const ImageParam &p, Buffer b) {
+    assert(defined() && "Can't set an input of an unbound BoundCall");
+    assert(b.defined() && "Can't bind an ImageParam to an undefined buffer");
+    for (size_t i = 0; i < image_param_args.size(); i++) {
+        if (image_param_args[i].second.name() == p.name()) {
+            assert(b.type() == p.type() && "Buffer and ImageParam have different element types");
+            set_arg(image_param_args[i].first, b);
+            return;
+        }
+    }
+    // The pipeline doesn't use this ImageParam
+}
+
+void BoundCall::report_unbound_args() const {
+    for (size_t i = 0; i < image_param_args.size(); i++) {
+        if (arg_values[image_param_args[i].first] == NULL) {
+            std::cerr << "ImageParam " << image_param_args[i].second.name()
+                      << " has no buffer. Set it with set_input, or set the ImageParam before binding.\n";
+        }
+    }
+    for (size_t i = arg_values.size() - output_types.size(); i < arg_values.size(); i++) {
+        if (arg_values[i] == NULL) {
+            std::cerr << "Set the output of a BoundCall before running it.\n";
+            break;
+        }
+    }
+}
+
+void BoundCall::use_optimized_code_if_ready() {
+    Func &f = tiered_source;
+    if (!f.pending_optimized.defined() || !f.pending_optimized.finished()) return;
+
+    f.use_optimized_code_if_ready();
+    if (!f.compiled_module.wrapped_function) {
+        // The optimized code was dropped because it may be shared
+        // with other Funcs, and this one has custom handlers.
+        tiered_source = Func();
+        return;
+    }
+    module = f.compiled_module;
+    module.set_error_handler(f.error_handler);
+    module.set_custom_allocator(f.custom_malloc, f.custom_free);
+    module.set_custom_do_par_for(f.custom_do_par_for);
+    module.set_custom_do_task(f.custom_do_task);
+    module.set_custom_trace(f.custom_trace);
+
+    for (size_t i = arg_values.size() - output_types.size(); i < arg_values.size(); i++) {
+        if (buffers[i].defined()) {
+            buffers[i].set_source_module(module);
+        }
     }
+
+    tiered_source = Func();
+}
+
+int BoundCall::run() {
+    assert(defined() && "Can't run an unbound BoundCall");
+    if (unbound_args) {
+        report_unbound_args();
+        assert(false);
+        return -1;
+    }
+    use_optimized_code_if_ready();
+    return module.wrapped_function(&(arg_values[0]));
+}
+
+int BoundCall::realize(Buffer dst) {
+    set_output(dst);
+    return run();
+}
+
+int BoundCall::realize(Realization dst) {
+    set_output(dst);
+    return run();
 }
 
 void Func::infer_input_bounds(Buffer dst) {
@@ -1783,6 +2089,8 @@ void Func::infer_input_bounds(Buffer dst) {
 }
 
 void Func::infer_input_bounds(Realization dst) {
+    finish_async_compile();
+    use_optimized_code_if_ready();
     if (!compiled_module.wrapped_function) compile_jit();
 
     assert(compiled_module.wrapped_function);
@@ -1883,6 +2191,18 @@ void Func::infer_input_bounds(Realization dst) {
 void *Func::compile_jit(const Target &target) {
     assert(defined() && "Can't realize undefined function");
 
+    finish_async_compile();
+    // The optimized code being built in the background would replace
+    // what we're about to compile. It still lands in the cache of
+    // jit-compiled pipelines, so the compile below may get it from
+    // there.
+    pending_optimized = AsyncTask();
+
+    compile_jit_module(target, false);
+    return compiled_module.function;
+}
+
+bool Func::compile_jit_module(const Target &target, bool fast) {
     if (!lowered.defined()) lowered = Halide::Internal::lower(func);
 
     // Infer arguments
@@ -1911,7 +2231,25 @@ void *Func::compile_jit(const Target &target) {
 
     Target t = target;
     t.features |= Target::JIT;
+
+    // Reuse the machine code for an earlier pipeline that lowered to
+    // the same thing, unless this Func has handlers of its own.
+    string module_cache_key;
+    if (!has_custom_handlers()) {
+        module_cache_key = jit_module_cache_key(lowered, func, infer_args.arg_types, t);
+    }
+    if (jit_module_cache_lookup(module_cache_key, &compiled_module)) {
+        jit_code_shared = true;
+        return true;
+    }
+
     StmtCompiler cg(t);
+    if (fast) {
+        // Quickly compiled code doesn't belong in either cache.
+        cg.set_fast_compile(true);
+    } else {
+        cg.set_jit_cache_key(jit_cache_key(lowered, name(), infer_args.arg_types, t));
+    }
     cg.compile(lowered, name(), infer_args.arg_types, vector<Buffer>());
 
     if (debug::debug_level >= 3) {
@@ -1922,8 +2260,215 @@ void *Func::compile_jit(const Target &target) {
     }
 
     compiled_module = cg.compile_to_function_pointers();
+    if (!fast && !module_cache_key.empty()) {
+        jit_module_cache_store(module_cache_key, compiled_module);
+        jit_code_shared = true;
+    }
 
-    return compiled_module.function;
+    return !fast;
+}
+
+void Func::specialize_param_values(int max_variants) {
+    assert(max_variants >= 0 && "Can't have a negative number of specialized versions");
+    max_param_variants = max_variants;
+}
+
+namespace {
+
+// The current value of a scalar Param as a constant of the same
+// type, or an undefined Expr if it can't be written exactly as one.
+Expr scalar_param_value(Internal::Parameter p) {
+    Type t = p.type();
+    if (t == Float(32)) {
+        return p.get_scalar<float>();
+    } else if (t == Float(64)) {
+        double v = p.get_scalar<double>();
+        if ((double)(float)v == v) return Cast::make(t, (float)v);
+    } else if (t == Bool()) {
+        return make_bool(p.get_scalar<bool>());
+    } else if (t == Int(8)) {
+        return make_const(t, p.get_scalar<int8_t>());
+    } else if (t == Int(16)) {
+        return make_const(t, p.get_scalar<int16_t>());
+    } else if (t == Int(32)) {
+        return p.get_scalar<int32_t>();
+    } else if (t == UInt(8)) {
+        return make_const(t, p.get_scalar<uint8_t>());
+    } else if (t == UInt(16)) {
+        return make_const(t, p.get_scalar<uint16_t>());
+    } else if (t == UInt(32)) {
+        uint32_t v = p.get_scalar<uint32_t>();
+        if (v <= 0x7fffffff) return make_const(t, (int)v);
+    } else if (t == Int(64)) {
+        int64_t v = p.get_scalar<int64_t>();
+        if (v == (int64_t)(int)v) return make_const(t, (int)v);
+    } else if (t == UInt(64)) {
+        uint64_t v = p.get_scalar<uint64_t>();
+        if (v <= 0x7fffffff) return make_const(t, (int)v);
+    }
+    return Expr();
+}
+
+}
+
+Func::ParamVariant *Func::get_param_variant(const Target &target) {
+    if (!found_scalar_params) {
+        if (!lowered.defined()) lowered = Halide::Internal::lower(func);
+        InferArguments infer_args(name());
+        lowered.accept(&infer_args);
+        scalar_params = infer_args.scalar_params;
+        found_scalar_params = true;
+    }
+
+    // Key the versions by the bits of the Param values. Printing them
+    // would make distinct floats look the same.
+    map<string, Expr> values;
+    std::ostringstream key;
+    for (size_t i = 0; i < scalar_params.size(); i++) {
+        // Values outside a Param's range are left to the generic
+        // code to report.
+        Expr value = scalar_param_value(scalar_params[i]);
+        if (!value.defined() || !Internal::param_value_in_range(scalar_params[i], value)) continue;
+        values[scalar_params[i].name()] = value;
+        const uint8_t *bits = (const uint8_t *)scalar_params[i].get_scalar_address();
+        key << scalar_params[i].name() << '=' << std::hex;
+        for (int b = 0; b < scalar_params[i].type().bytes(); b++) {
+            key << (int)bits[b] << ':';
+        }
+        key << std::dec << ';';
+    }
+    if (values.empty()) return NULL;
+
+    map<string, ParamVariant>::iterator iter = param_variants.find(key.str());
+    if (iter != param_variants.end()) {
+        return &(iter->second);
+    }
+
+    if ((int)param_variants.size() >= max_param_variants) {
+        Internal::debug(1) << "Already have " << param_variants.size()
+                           << " versions of " << name()
+                           << " specialized to Param values. Using the generic code.\n";
+        return NULL;
+    }
+
+    Internal::debug(1) << "Compiling a version of " << name()
+                       << " specialized to Param values " << key.str() << "\n";
+
+    // Compile the specialized version through this Func, so that it
+    // goes through the same caches as the generic code, then put the
+    // generic code back.
+    Stmt generic_lowered = lowered;
+    JITCompiledModule generic_module = compiled_module;
+    vector<const void *> generic_arg_values = arg_values;
+    vector<pair<int, Internal::Parameter> > generic_image_param_args = image_param_args;
+
+    lowered = Halide::Internal::lower(func, values);
+    compile_jit_module(target, false);
+
+    ParamVariant &variant = param_variants[key.str()];
+    variant.module = compiled_module;
+    variant.arg_values = arg_values;
+    variant.image_param_args = image_param_args;
+
+    lowered = generic_lowered;
+    compiled_module = generic_module;
+    arg_values = generic_arg_values;
+    image_param_args = generic_image_param_args;
+
+    return &variant;
+}
+
+namespace {
+
+// Compiles a copy of a Func on a background thread. The copy shares
+// the definition of the original, but gets its own compiled module.
+class CompileWork : public AsyncWork {
+public:
+    Func f;
+    Target target;
+    CompileWork(Func f, const Target &t) : f(f), target(t) {}
+    void run() {
+        f.compile_jit(target);
+    }
+};
+
+// Realizes a copy of a Func on a background thread.
+class RealizeWork : public AsyncWork {
+public:
+    Func f;
+    Realization dst;
+    Target target;
+    RealizeWork(Func f, Realization d, const Target &t) : f(f), dst(d), target(t) {}
+    void run() {
+        f.realize(dst, target);
+    }
+};
+
+}
+
+AsyncTask Func::compile_jit_async(const Target &target) {
+    assert(defined() && "Can't realize undefined function");
+    finish_async_compile();
+    pending_optimized = AsyncTask();
+    pending_compile = AsyncTask(new CompileWork(*this, target));
+    return pending_compile;
+}
+
+void Func::finish_async_compile() {
+    if (!pending_compile.defined()) return;
+    pending_compile.wait();
+    const Func &compiled = static_cast<CompileWork *>(pending_compile.work())->f;
+    lowered = compiled.lowered;
+    compiled_module = compiled.compiled_module;
+    arg_values = compiled.arg_values;
+    image_param_args = compiled.image_param_args;
+    jit_code_shared = compiled.jit_code_shared;
+    pending_compile = AsyncTask();
+    // A handler may have been set while it was compiling.
+    stop_sharing_jit_code();
+}
+
+AsyncTask Func::compile_jit_tiered(const Target &target) {
+    assert(defined() && "Can't realize undefined function");
+    finish_async_compile();
+    pending_optimized = AsyncTask();
+
+    if (compile_jit_module(target, true)) {
+        // Another pipeline that lowered to the same thing already has
+        // optimized code.
+        return AsyncTask();
+    }
+
+    // The copy lowers nothing, because it gets the lowered form of
+    // this Func.
+    pending_optimized = AsyncTask(new CompileWork(*this, target));
+    return pending_optimized;
+}
+
+void Func::use_optimized_code_if_ready() {
+    if (!pending_optimized.defined() || !pending_optimized.finished()) return;
+    // The argument list is the same for both, because they were
+    // compiled from the same lowered form.
+    const Func &optimized = static_cast<CompileWork *>(pending_optimized.work())->f;
+    compiled_module = optimized.compiled_module;
+    jit_code_shared = jit_code_shared || optimized.jit_code_shared;
+    pending_optimized = AsyncTask();
+    // A handler may have been set while it was compiling.
+    stop_sharing_jit_code();
+}
+
+AsyncTask Func::realize_async(Realization dst, const Target &target) {
+    assert(defined() && "Can't realize undefined function");
+    // Compile in the background too, in a way that lets this Func
+    // pick up the compiled module for later calls.
+    if (!compiled_module.wrapped_function && !pending_compile.defined()) {
+        compile_jit_async(target);
+    }
+    return AsyncTask(new RealizeWork(*this, dst, target));
+}
+
+AsyncTask Func::realize_async(Buffer dst, const Target &target) {
+    return realize_async(Realization(vec<Buffer>(dst)), target);
 }
 
 void Func::test() {
@@ -18,6 +18,9 @@
 #include "Util.h"
 #include "Target.h"
 #include "Tuple.h"
+#include "AsyncTask.h"
+
+#include <map>
 
 namespace Halide {
 
@@ -28,6 +31,8 @@ namespace Halide {
  */
 class FuncRefExpr;
 
+class BoundCall;
+
 /** A class that can represent Vars or RVars. Used for reorder calls
  * which can accept a mix of either. */
 struct VarOrRVar {
@@ -323,6 +328,73 @@ class Func {
      * still be valid though. */
     std::vector<std::pair<int, Internal::Parameter> > image_param_args;
 
+    /** A compilation started by compile_jit_async that this Func
+     * hasn't picked up the results of yet. */
+    AsyncTask pending_compile;
+
+    /** Wait for any compilation started by compile_jit_async, and
+     * take the compiled module from it. */
+    void finish_async_compile();
+
+    /** The fully optimized build started by compile_jit_tiered, while
+     * this Func runs the quickly compiled one. */
+    AsyncTask pending_optimized;
+
+    /** Switch to the fully optimized code if it's done, without
+     * waiting for it. */
+    void use_optimized_code_if_ready();
+
+    /** Lower and jit compile the function. If fast is set, generate
+     * slower code quickly, and keep it out of the jit caches. Returns
+     * whether the result is fully optimized. */
+    bool compile_jit_module(const Target &target, bool fast);
+
+    /** A version of the jit-compiled function with the current values
+     * of its scalar Params baked in as constants. */
+    struct ParamVariant {
+        Internal::JITCompiledModule module;
+        std::vector<const void *> arg_values;
+        std::vector<std::pair<int, Internal::Parameter> > image_param_args;
+    };
+
+    /** The most versions specialized to Param values to compile. Zero
+     * means don't specialize. See specialize_param_values. */
+    int max_param_variants;
+
+    /** The scalar Params used by the generic lowered form, and whether
+     * we've looked for them yet. */
+    std::vector<Internal::Parameter> scalar_params;
+    bool found_scalar_params;
+
+    /** The specialized versions compiled so far, keyed by the Param
+     * values they were specialized to. */
+    std::map<std::string, ParamVariant> param_variants;
+
+    /** Find or compile the version of the function specialized to the
+     * current Param values. Returns NULL if there's nothing to
+     * specialize, or if there's no such version and there are already
+     * max_param_variants others. */
+    ParamVariant *get_param_variant(const Target &target);
+
+    /** Whether the jit-compiled code came from or went into the jit
+     * module cache, in which case other Funcs may be using it too. */
+    bool jit_code_shared;
+
+    /** Whether any of the handlers above have been set. The handlers
+     * are globals of the compiled module, so Funcs that set them
+     * compile code of their own rather than sharing it with other
+     * Funcs through the jit module cache. */
+    bool has_custom_handlers() const;
+
+    /** Called when a handler is set. If the compiled code may be
+     * shared with other Funcs, drop it, so that the next realize
+     * compiles code of its own. */
+    void stop_sharing_jit_code();
+
+    /** A BoundCall picks up the optimized code from
+     * compile_jit_tiered the same way this does. */
+    friend class BoundCall;
+
 public:
     EXPORT static void test();
 
@@ -488,6 +560,72 @@ public:
      */
      EXPORT void *compile_jit(const Target &target = get_jit_target_from_environment());
 
+    /** Start jit compiling the function on a background thread, and
+     * return right away. The next call that needs the compiled
+     * function (e.g. realize) waits for it to finish. Don't change
+     * the definition or schedule of this Func or any Func it calls
+     * until then. Compiling other pipelines meanwhile is fine. */
+    EXPORT AsyncTask compile_jit_async(const Target &target = get_jit_target_from_environment());
+
+    /** Jit compile the function in two tiers. First generate code
+     * quickly, skipping llvm's optimizations, and return once it's
+     * ready. Then build fully optimized code on a background
+     * thread. The first realize after it finishes switches to it, so
+     * each realize runs entirely on one tier or the other. Returns
+     * the background build, so that you can wait for it, or an
+     * undefined task if optimized code for this pipeline was already
+     * available. Don't change the definition or schedule of this Func
+     * until the background build finishes. */
+    EXPORT AsyncTask compile_jit_tiered(const Target &target = get_jit_target_from_environment());
+
+    /** Evaluate this function into an existing allocated buffer or
+     * buffers on a background thread, compiling it there first if
+     * need be. Don't look at or free the buffers, and don't change
+     * this Func, until the returned task has finished. Runtime errors
+     * go to the error handler on the background thread. */
+    // @{
+    EXPORT AsyncTask realize_async(Realization dst, const Target &target = get_jit_target_from_environment());
+    EXPORT AsyncTask realize_async(Buffer dst, const Target &target = get_jit_target_from_environment());
+    // @}
+
+    /** Evaluate this function over a batch of independent inputs and
+     * outputs, in one call into the compiled code. The items of the
+     * batch are the tasks of a parallel for loop on the thread pool,
+     * with any parallel loops in the pipeline nested inside
+     * it. inputs[i][j] is the buffer to use for params[j] when
+     * realizing into outputs[i]. Other ImageParams, and scalar
+     * Params, have the same value for every item. Each item is
+     * checked and run as if realized on its own, so it may be a
+     * different size to the others. */
+    // @{
+    EXPORT void realize_batch(const std::vector<Realization> &outputs,
+                              const std::vector<ImageParam> &params,
+                              const std::vector<std::vector<Buffer> > &inputs,
+                              const Target &target = get_jit_target_from_environment());
+    EXPORT void realize_batch(const std::vector<Buffer> &outputs,
+                              const std::vector<ImageParam> &params,
+                              const std::vector<std::vector<Buffer> > &inputs,
+                              const Target &target = get_jit_target_from_environment());
+    // @}
+
+    /** Jit compile a separate version of this function for each set
+     * of values of its scalar Params that realize is called with,
+     * with those values baked in as constants. This lets the
+     * simplifier fold them, and lets loops whose extents depend on
+     * them be unrolled or vectorized. Once max_variants versions
+     * exist, realize uses the generic code for any other
+     * values. Zero, the default, turns this off. Only realize uses
+     * the specialized versions; bind, realize_batch, and
+     * infer_input_bounds always use the generic code. Float64 and
+     * 64-bit integer Params are only baked in when their values can
+     * be represented exactly as a 32-bit constant. */
+    EXPORT void specialize_param_values(int max_variants = 8);
+
+    /** Compile this function if need be, and return a handle that
+     * calls the compiled code with as little work per call as
+     * possible. See \ref BoundCall. */
+    EXPORT BoundCall bind(const Target &target = get_jit_target_from_environment());
+
     /** Set the error handler function that be called in the case of
      * runtime errors during halide pipelines. If you are compiling
      * statically, you can also just define your own function with
@@ -1151,11 +1289,51 @@ public:
      */
     EXPORT Func &compute_inline();
 
+    /** Put the storage for this function on the stack. Allocations
+     * whose size can be bounded by a constant of at most 8KB go on the
+     * stack anyway (the limit can be changed with the environment
+     * variable HL_MAX_STACK_ALLOCATION), and the rest go on the
+     * heap. This puts this function's storage on the stack as long as
+     * its size can be bounded by a constant at all, however big the
+     * bound is. E.g. a Func computed per tile of a Func split by a
+     * constant factor will usually qualify. Beware that the stacks of
+     * the threads running parallel loops may be small. */
+    EXPORT Func &store_in_stack();
+
     /** Get a handle on an update step of a reduction for the
      * purposes of scheduling it. Only the pure dimensions of the
      * update step can be meaningfully manipulated (see \ref RDom) */
     EXPORT ScheduleHandle update(int idx = 0);
 
+    /** Add an alternative schedule for the pure definition of this
+     * Func, to use whenever the condition is true when the pipeline
+     * runs. Returns a handle on it for the purposes of scheduling
+     * it. It starts out as a copy of the current schedule, so finish
+     * the parts the two have in common first. The handle is only
+     * valid until the next call to specialize.
+     *
+     * The pipeline is lowered once per specialization, and once more
+     * for the generic schedule, and the versions are selected between
+     * at the top. Conditions are tried in the order they were added,
+     * and may only depend on Params and on the sizes, strides, and
+     * mins of input and output buffers. For example:
+     *
+     \code
+     ImageParam im(Float(32), 2);
+     Func f;
+     f(x, y) = im(x, y) * 2;
+     f.specialize(im.stride(0) == 1 && f.output_buffer().stride(0) == 1).vectorize(x, 8);
+     f.specialize(im.width() % 4 == 0).vectorize(x, 4);
+     \endcode
+     *
+     * Within a specialization, any conditions of the form param ==
+     * constant, param, or !param (or conjunctions of them) are
+     * substituted into the code, so that the simplifier can use
+     * them. Only meaningful for the Func being compiled. Schedules of
+     * the update steps and of other Funcs are shared by all the
+     * versions. */
+    EXPORT ScheduleHandle specialize(Expr condition);
+
     /** Trace all loads from this Func by emitting calls to
      * halide_trace. If the Func is inlined, this has no
      * effect. */
@@ -1210,6 +1388,102 @@ public:
 
 };
 
+/** A compiled Func with its arguments laid out, ready to be called
+ * over and over. Func::realize works out where each argument goes,
+ * and installs the error handler, custom allocator, and so on, every
+ * time it's called. A BoundCall does that once, when \ref Func::bind
+ * makes it, so that calling it costs little more than calling the
+ * compiled code:
+ *
+ \code
+ BoundCall call = f.bind();
+ for (...) {
+     radius.set(r);
+     call.set_input(input, next_frame);
+     call.realize(output);
+ }
+ \endcode
+ *
+ * Scalar Params are read from the Params themselves, so Param::set
+ * takes effect on the next call. ImageParams are read when the call
+ * is bound, and after that only change through set_input. Handlers
+ * set on the Func after binding don't take effect until it's bound
+ * again. Neither does realizing another Func that shares the compiled
+ * code (see \ref set_jit_module_cache_size), so bind again after
+ * doing that. If the Func was bound while the optimized code from
+ * \ref Func::compile_jit_tiered was still compiling, the call switches
+ * to it once it's done, with the handlers the Func had when it was
+ * bound. */
+class BoundCall {
+    Internal::JITCompiledModule module;
+
+    /** As in Func. The last few are the outputs. */
+    std::vector<const void *> arg_values;
+    std::vector<std::pair<int, Internal::Parameter> > image_param_args;
+
+    /** The buffers that arg_values point into, so that they stay
+     * alive. Same indexing as arg_values. */
+    std::vector<Buffer> buffers;
+
+    /** What the outputs need to look like */
+    // @{
+    std::vector<Type> output_types;
+    int output_dimensions;
+    // @}
+
+    /** How many of arg_values are still NULL, because an ImageParam
+     * had no buffer when this was bound, or because an output hasn't
+     * been set yet. */
+    int unbound_args;
+
+    /** If the optimized code from a tiered compile wasn't ready when
+     * this was bound, a copy of the Func as it was then, which is
+     * still waiting for it. Otherwise an unused Func. */
+    Func tiered_source;
+
+    friend class Func;
+
+    void set_output_buffer(size_t i, Buffer dst);
+    void set_arg(size_t idx, Buffer b);
+
+    /** Complain about the arguments that haven't been set. */
+    void report_unbound_args() const;
+
+    /** Switch to the optimized code from a tiered compile if it's
+     * done, without waiting for it. */
+    void use_optimized_code_if_ready();
+
+public:
+    BoundCall() : output_dimensions(0), unbound_args(0) {}
+
+    /** Check if this has been bound to a Func */
+    bool defined() const {
+        return module.wrapped_function != NULL;
+    }
+
+    /** Set the buffer or buffers to realize into on the following
+     * calls. */
+    // @{
+    EXPORT void set_output(Buffer dst);
+    EXPORT void set_output(Realization dst);
+    // @}
+
+    /** Set the buffer an ImageParam refers to on the following
+     * calls. Doesn't change the ImageParam. */
+    EXPORT void set_input(const ImageParam &p, Buffer b);
+
+    /** Run the compiled code, with the current inputs and
+     * outputs. Returns zero on success, or the error code passed to
+     * the error handler. */
+    EXPORT int run();
+
+    /** Set the outputs and run. */
+    // @{
+    EXPORT int realize(Buffer dst);
+    EXPORT int realize(Realization dst);
+    // @}
+};
+
 /** JIT-Compile and run enough code to evaluate a Halide
  * expression. This can be thought of as a scalar version of
  * \ref Func::realize */
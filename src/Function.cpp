@@ -282,6 +282,79 @@ void Function::define_reduction(const vector<Expr> &_args, vector<Expr> values)
 
 }
 
+Schedule &Function::add_specialization(Expr condition) {
+    assertf(has_pure_definition(), "Can't specialize the schedule of a function with no pure definition", name());
+    assertf(condition.defined() && condition.type().is_bool(),
+            "The condition of a specialization must be a boolean", name());
+
+    // Any variables in the condition must be parameters, because
+    // that's all that will be defined at the top of the pipeline.
+    CheckVars check(name());
+    check.pure_args.resize(args().size());
+    condition.accept(&check);
+    assertf(!check.reduction_domain.defined(), "Reduction domain referenced in the condition of a specialization", name());
+
+    Specialization s;
+    s.condition = condition;
+    s.schedule = contents.ptr->schedule;
+    contents.ptr->specializations.push_back(s);
+    return contents.ptr->specializations.back().schedule;
+}
+
+namespace {
+// Point calls to one function at another
+class RedirectCalls : public IRMutator {
+    Function from, to;
+
+    using IRMutator::visit;
+
+    void visit(const Call *op) {
+        IRMutator::visit(op);
+        op = expr.as<Call>();
+        if (op && op->call_type == Call::Halide && op->func.same_as(from)) {
+            expr = Call::make(op->type, op->name, op->args, op->call_type,
+                              to, op->value_index, op->image, op->param);
+        }
+    }
+
+public:
+    RedirectCalls(Function f, Function t) : from(f), to(t) {}
+};
+}
+
+Function Function::with_pure_schedule(const Schedule &s) const {
+    assertf(has_pure_definition(), "Can't copy a function with no pure definition", name());
+
+    // Replay the definitions, so that the copy accounts for its
+    // references to itself in the same way.
+    Function copy(name());
+    copy.define(args(), values());
+
+    RedirectCalls redirect(*this, copy);
+    for (size_t i = 0; i < reductions().size(); i++) {
+        const ReductionDefinition &r = reductions()[i];
+        vector<Expr> r_args(r.args.size()), r_values(r.values.size());
+        for (size_t j = 0; j < r_args.size(); j++) {
+            r_args[j] = redirect.mutate(r.args[j]);
+        }
+        for (size_t j = 0; j < r_values.size(); j++) {
+            r_values[j] = redirect.mutate(r.values[j]);
+        }
+        copy.define_reduction(r_args, r_values);
+        copy.contents.ptr->reductions[i].schedule = r.schedule;
+    }
+
+    // Share everything the user set up other than the schedule,
+    // including the output buffers and their constraints.
+    copy.contents.ptr->schedule = s;
+    copy.contents.ptr->output_buffers = contents.ptr->output_buffers;
+    copy.contents.ptr->debug_file = contents.ptr->debug_file;
+    copy.contents.ptr->trace_loads = contents.ptr->trace_loads;
+    copy.contents.ptr->trace_stores = contents.ptr->trace_stores;
+    copy.contents.ptr->trace_realizations = contents.ptr->trace_realizations;
+    return copy;
+}
+
 void Function::define_extern(const std::string &function_name,
                              const std::vector<ExternFuncArgument> &args,
                              const std::vector<Type> &types,
@@ -53,6 +53,13 @@ struct ReductionDefinition {
     ReductionDomain domain;
 };
 
+/** An alternative schedule for the pure definition of a function,
+ * to use when the condition is true. See Func::specialize. */
+struct Specialization {
+    Expr condition;
+    Schedule schedule;
+};
+
 struct FunctionContents {
     mutable RefCount ref_count;
     std::string name;
@@ -63,6 +70,8 @@ struct FunctionContents {
 
     std::vector<ReductionDefinition> reductions;
 
+    std::vector<Specialization> specializations;
+
     std::string debug_file;
 
     std::vector<Parameter> output_buffers;
@@ -185,6 +194,25 @@ public:
         return contents.ptr->reductions;
     }
 
+    /** Add an alternative schedule for the pure definition, to use
+     * when the condition is true. It starts out as a copy of the
+     * current schedule. Returns a handle to it for the purpose of
+     * modifying it. */
+    Schedule &add_specialization(Expr condition);
+
+    /** Make a new function with the same name and definition as this
+     * one, whose pure definition has the given schedule
+     * instead. References to this function in its own update steps
+     * refer to the new one. Used to lower specializations without
+     * modifying this function. */
+    Function with_pure_schedule(const Schedule &s) const;
+
+    /** Get the alternative schedules for the pure definition, in the
+     * order they should be tried. */
+    const std::vector<Specialization> &specializations() const {
+        return contents.ptr->specializations;
+    }
+
     /** Does this function have a reduction definition */
     bool has_reduction_definition() const {
         return !contents.ptr->reductions.empty();
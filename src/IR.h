@@ -785,14 +785,17 @@ struct Provide : public StmtNode<Provide> {
 /** Allocate a scratch area called with the given name, type, and
  * size. The buffer lives for at most the duration of the body
  * statement, within which it is freed. It is an error for an allocate
- * node not to contain a free node of the same buffer. */
+ * node not to contain a free node of the same buffer. If on_stack is
+ * set, the buffer goes on the stack regardless of its size, as long as
+ * the size is a constant (see Func::store_in_stack). */
 struct Allocate : public StmtNode<Allocate> {
     std::string name;
     Type type;
     Expr size;
     Stmt body;
+    bool on_stack;
 
-    static Stmt make(std::string name, Type type, Expr size, Stmt body) {
+    static Stmt make(std::string name, Type type, Expr size, Stmt body, bool on_stack = false) {
         assert(size.defined() && "Allocate of undefined");
         assert(body.defined() && "Allocate of undefined");
         assert(size.type().is_scalar() == 1 && "Allocate of vector size");
@@ -802,6 +805,7 @@ struct Allocate : public StmtNode<Allocate> {
         node->type = type;
         node->size = size;
         node->body = body;
+        node->on_stack = on_stack;
         return node;
     }
 };
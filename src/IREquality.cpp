@@ -360,11 +360,17 @@ public:
 
         if (compare_names(s->name, op->name)) return;
 
-        expr = s->size;
-        op->size.accept(this);
+        if (s->on_stack < op->on_stack) {
+            result = -1;
+        } else if (s->on_stack > op->on_stack) {
+            result = 1;
+        } else {
+            expr = s->size;
+            op->size.accept(this);
 
-        stmt = s->body;
-        op->body.accept(this);
+            stmt = s->body;
+            op->body.accept(this);
+        }
     }
 
     void visit(const Realize *op) {
@@ -231,7 +231,7 @@ void IRMutator::visit(const Allocate *op) {
     Expr size = mutate(op->size);
     Stmt body = mutate(op->body);
     if (size.same_as(op->size) && body.same_as(op->body)) stmt = op;
-    else stmt = Allocate::make(op->name, op->type, size, body);
+    else stmt = Allocate::make(op->name, op->type, size, body, op->on_stack);
 }
 
 void IRMutator::visit(const Free *op) {
@@ -1,5 +1,6 @@
 #include "IROperator.h"
 #include "IRPrinter.h"
+#include "IRVisitor.h"
 #include "Simplify.h"
 #include <iostream>
 #include <math.h>
@@ -119,6 +120,35 @@ bool is_two(Expr e) {
     return false;
 }
 
+namespace {
+class ReadsMemory : public IRVisitor {
+public:
+    bool result;
+    ReadsMemory() : result(false) {}
+
+private:
+    using IRVisitor::visit;
+
+    void visit(const Load *op) {
+        result = true;
+    }
+
+    void visit(const Call *op) {
+        if (op->call_type != Call::Intrinsic) {
+            result = true;
+        } else {
+            IRVisitor::visit(op);
+        }
+    }
+};
+}
+
+bool reads_memory(Expr e) {
+    ReadsMemory reads;
+    e.accept(&reads);
+    return reads.result;
+}
+
 int int_cast_constant(Type t, int val) {
     // Unsigned of less than 32 bits is masked to select the appropriate bits
     if (t.is_uint()) {
@@ -53,6 +53,12 @@ EXPORT bool is_one(Expr e);
  * to two (in all lanes, if a vector expression) */
 EXPORT bool is_two(Expr e);
 
+/** Does the expression load from memory, or call anything other than
+ * an intrinsic? If not, its value depends only on the variables it
+ * refers to, so it can be evaluated anywhere they're defined (e.g. to
+ * hoist an allocation size out of the statement it appears in). */
+EXPORT bool reads_memory(Expr e);
+
 /** Given an integer value, cast it into a designated integer type
  * and return the bits as int. Unsigned types are returned as bits in the int
  * and should be cast to unsigned int for comparison.
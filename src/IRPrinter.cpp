@@ -453,7 +453,11 @@ void IRPrinter::visit(const Allocate *op) {
     do_indent();
     stream << "allocate " << op->name << "[" << op->type << " * ";
     print(op->size);
-    stream << "]\n";
+    stream << "]";
+    if (op->on_stack) {
+        stream << " on stack";
+    }
+    stream << "\n";
     print(op->body);
 }
 
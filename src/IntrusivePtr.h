@@ -11,16 +11,34 @@
 
 #include <stdlib.h>
 #include <iostream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace Halide {
 namespace Internal {
 
-/** A class representing a reference count to be used with IntrusivePtr */
+/** A class representing a reference count to be used with
+ * IntrusivePtr. The count is updated atomically, so that handles to
+ * the same object can be copied and dropped on different threads
+ * (e.g. by Func::compile_jit_async). */
 class RefCount {
-    int count;
+    volatile int count;
+
+    int add(int delta) {
+        #ifdef _MSC_VER
+        return _InterlockedExchangeAdd((volatile long *)&count, delta) + delta;
+        #else
+        return __sync_add_and_fetch(&count, delta);
+        #endif
+    }
+
 public:
     RefCount() : count(0) {}
-    void increment() {count++;}
-    void decrement() {count--;}
+    void increment() {add(1);}
+    /** Returns the new count. */
+    int decrement() {return add(-1);}
     bool is_zero() const {return count == 0;}
 };
 
@@ -64,8 +82,9 @@ private:
 
     void decref(T *p) {
         if (p) {
-            ref_count(p).decrement();
-            if (ref_count(p).is_zero()) {
+            // Check the count returned by the decrement, rather than
+            // reading it again, so that only one thread destroys it.
+            if (ref_count(p).decrement() == 0) {
                 //std::cout << "Destroying " << ptr << ", " << live_objects << "\n";
                 destroy(p);
             }
@@ -0,0 +1,261 @@
+#include "JITCache.h"
+#include "IRPrinter.h"
+#include "StackAllocation.h"
+#include "AllocationTracking.h"
+#include "LLVM_Headers.h"
+#include "Debug.h"
+#include "Threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace Halide {
+
+using std::string;
+using std::vector;
+using std::ostringstream;
+
+namespace {
+// Set by set_jit_cache_directory. Until then we use HL_JIT_CACHE_DIR.
+bool jit_cache_directory_set = false;
+string jit_cache_directory_override;
+
+Internal::Mutex &jit_cache_directory_mutex() {
+    static Internal::Mutex *mutex = new Internal::Mutex;
+    return *mutex;
+}
+
+// The first line of every cache entry. Bump this if the layout of
+// the file changes.
+const char *jit_cache_magic = "halide jit cache 1\n";
+}
+
+void set_jit_cache_directory(const string &dir) {
+    Internal::ScopedLock lock(jit_cache_directory_mutex());
+    jit_cache_directory_set = true;
+    jit_cache_directory_override = dir;
+}
+
+namespace Internal {
+
+namespace {
+// 64-bit FNV-1a. Pass in the previous result to hash data in pieces.
+uint64_t hash_bytes(const char *data, size_t size, uint64_t h = 14695981039346656037ULL) {
+    for (size_t i = 0; i < size; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t hash_string(const string &s) {
+    return hash_bytes(s.data(), s.size());
+}
+
+// The path of the binary this code was loaded from: libHalide, or
+// the program itself if Halide was linked in statically.
+string halide_binary_path() {
+    #ifdef _WIN32
+    HMODULE module = NULL;
+    char path[MAX_PATH];
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                            GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            (LPCSTR)&jit_cache_magic, &module) ||
+        GetModuleFileNameA(module, path, MAX_PATH) == 0) {
+        return "";
+    }
+    return path;
+    #else
+    Dl_info info;
+    if (!dladdr((const void *)&jit_cache_magic, &info) || !info.dli_fname) {
+        return "";
+    }
+    return info.dli_fname;
+    #endif
+}
+
+// Identifies the build of Halide, so that native code compiled by
+// other builds isn't loaded. It's a hash of the contents of the
+// binary, computed the first time it's needed. Empty if the binary
+// can't be read.
+string halide_build_id() {
+    static Mutex *mutex = new Mutex;
+    static bool computed = false;
+    static string id;
+
+    ScopedLock lock(*mutex);
+    if (computed) return id;
+    computed = true;
+
+    string path = halide_binary_path();
+    FILE *f = path.empty() ? NULL : fopen(path.c_str(), "rb");
+    if (!f) {
+        debug(1) << "Can't read the Halide binary to identify the build. Not using the jit cache.\n";
+        return id;
+    }
+
+    uint64_t h = hash_bytes(NULL, 0);
+    vector<char> chunk(1 << 16);
+    size_t n;
+    while ((n = fread(&chunk[0], 1, chunk.size(), f)) > 0) {
+        h = hash_bytes(&chunk[0], n, h);
+    }
+    fclose(f);
+
+    ostringstream str;
+    str << std::hex << h;
+    id = str.str();
+    debug(1) << "Halide build " << id << " from " << path << "\n";
+    return id;
+}
+
+// Prints float constants exactly, because the default printing
+// rounds them to six digits and different constants would get the
+// same key.
+class ExactIRPrinter : public IRPrinter {
+public:
+    ExactIRPrinter(std::ostream &s) : IRPrinter(s) {}
+
+protected:
+    using IRPrinter::visit;
+
+    void visit(const FloatImm *op) {
+        uint32_t bits;
+        memcpy(&bits, &op->value, sizeof(bits));
+        stream << "float(0x" << std::hex << bits << std::dec << ")";
+    }
+};
+
+// Entries are named after the hash of the key, and hold the whole
+// key, so that we can tell when two keys collide.
+string jit_cache_path(const string &key) {
+    ostringstream path;
+    path << jit_cache_directory() << "/" << std::hex << hash_string(key) << ".o";
+    return path.str();
+}
+}
+
+string jit_cache_directory() {
+    ScopedLock lock(jit_cache_directory_mutex());
+    if (jit_cache_directory_set) {
+        return jit_cache_directory_override;
+    }
+    char *dir = getenv("HL_JIT_CACHE_DIR");
+    return dir ? dir : "";
+}
+
+string jit_cache_key(Stmt s, const string &name, const vector<Argument> &args, const Target &t) {
+    if (jit_cache_directory().empty()) {
+        return "";
+    }
+
+    // Without MCJIT there's no way to hand llvm an object file to
+    // load instead of compiling.
+    #if !defined(USE_MCJIT) || LLVM_VERSION < 33
+    return "";
+    #endif
+
+    // Gpu kernels get compiled and loaded separately from the host
+    // code, so only the host code would come from the cache.
+    if (t.features & (Target::CUDA | Target::OpenCL)) {
+        return "";
+    }
+
+    string build = halide_build_id();
+    if (build.empty()) {
+        return "";
+    }
+
+    ostringstream key;
+    key << "halide " << build << "\n"
+        << "llvm " << LLVM_VERSION << "\n"
+        << "target " << t.os << " " << t.arch << " " << t.bits << " " << t.features << "\n"
+        << "max stack allocation " << max_stack_allocation_bytes() << "\n"
+        << "track allocations " << allocation_tracking_enabled() << "\n"
+        << "function " << name << "\n";
+    for (size_t i = 0; i < args.size(); i++) {
+        key << "argument " << args[i].name << " " << args[i].is_buffer << " " << args[i].type << "\n";
+    }
+    print_for_jit_cache_key(key, s);
+    return key.str();
+}
+
+void print_for_jit_cache_key(std::ostream &stream, Stmt s) {
+    ExactIRPrinter printer(stream);
+    printer.print(s);
+}
+
+bool jit_cache_load(const string &key, vector<char> *object) {
+    string path = jit_cache_path(key);
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        debug(1) << "No entry in the jit cache at " << path << "\n";
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    vector<char> contents(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(&contents[0], 1, size, f) == (size_t)size;
+    fclose(f);
+
+    // Check the magic string and the key, which are followed by the
+    // object file.
+    string header = string(jit_cache_magic) + key;
+    ok = ok && contents.size() > header.size() &&
+        std::equal(header.begin(), header.end(), contents.begin());
+    if (!ok) {
+        debug(1) << "Entry in the jit cache at " << path << " is for something else\n";
+        return false;
+    }
+
+    debug(1) << "Loading cached object file " << path << "\n";
+    object->assign(contents.begin() + header.size(), contents.end());
+    return true;
+}
+
+void jit_cache_store(const string &key, const char *object, size_t size) {
+    string path = jit_cache_path(key);
+
+    // Write to a temporary file and rename it into place, so that
+    // other processes reading the cache never see half an entry. The
+    // name is unique to this thread too, in case another thread is
+    // saving the same pipeline.
+    string tmp_path = path + ".tmp." + int_to_string(getpid()) + "." + unique_name('t');
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        debug(1) << "Could not write to the jit cache at " << tmp_path << "\n";
+        return;
+    }
+
+    bool ok = (fputs(jit_cache_magic, f) >= 0 &&
+               fwrite(key.data(), 1, key.size(), f) == key.size() &&
+               fwrite(object, 1, size, f) == size);
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok && rename(tmp_path.c_str(), path.c_str()) == 0) {
+        debug(1) << "Saved object file to the jit cache at " << path << "\n";
+    } else {
+        debug(1) << "Could not write to the jit cache at " << path << "\n";
+        remove(tmp_path.c_str());
+    }
+}
+
+}
+}
@@ -0,0 +1,55 @@
+#ifndef HALIDE_JIT_CACHE_H
+#define HALIDE_JIT_CACHE_H
+
+/** \file
+ * Defines the on-disk cache of jit-compiled pipelines
+ */
+
+#include "IR.h"
+#include "Argument.h"
+#include "Target.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Halide {
+
+/** Set the directory in which jit-compiled pipelines are cached
+ * between runs. Overrides the environment variable
+ * HL_JIT_CACHE_DIR. The directory must already exist. Pass the empty
+ * string to turn off the cache. */
+EXPORT void set_jit_cache_directory(const std::string &dir);
+
+namespace Internal {
+
+/** The directory jit-compiled pipelines are cached in, or the empty
+ * string if there isn't one. */
+std::string jit_cache_directory();
+
+/** Make a key that identifies the native code for a lowered pipeline
+ * compiled for the given target. It covers everything else that
+ * affects code generation too: the argument list, the environment
+ * variables read during codegen, and the versions of Halide and
+ * llvm. Returns the empty string if the cache is off, or can't be
+ * used for this target (e.g. gpu targets). */
+std::string jit_cache_key(Stmt s, const std::string &name,
+                          const std::vector<Argument> &args,
+                          const Target &t);
+
+/** Print a lowered statement as part of a cache key. Unlike
+ * operator<<, this prints float constants exactly. */
+void print_for_jit_cache_key(std::ostream &stream, Stmt s);
+
+/** Look up the object file for a key made by \ref jit_cache_key. Returns
+ * false if there isn't one. */
+bool jit_cache_load(const std::string &key, std::vector<char> *object);
+
+/** Save the object file for a key made by \ref jit_cache_key. Failing
+ * to write it is not an error. */
+void jit_cache_store(const std::string &key, const char *object, size_t size);
+
+}
+}
+
+#endif
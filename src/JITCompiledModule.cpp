@@ -4,6 +4,9 @@
 #include "CodeGen.h"
 #include "LLVM_Headers.h"
 #include "Debug.h"
+#include "Target.h"
+#include "JITCache.h"
+#include "Threads.h"
 
 #include <string>
 
@@ -20,11 +23,10 @@ class JITModuleHolder {
 public:
     mutable RefCount ref_count;
 
-    JITModuleHolder(llvm::ExecutionEngine *ee, llvm::Module *m, void (*stop_threads)()) :
+    JITModuleHolder(llvm::ExecutionEngine *ee, llvm::Module *m) :
         execution_engine(ee),
         module(m),
-        context(&m->getContext()),
-        shutdown_thread_pool(stop_threads) {
+        context(&m->getContext()) {
     }
 
     ~JITModuleHolder() {
@@ -34,7 +36,9 @@ public:
             (*cleanup_routines[i])();
         }
 
-        shutdown_thread_pool();
+        // The thread pool is shared with other modules, so we leave
+        // it running. Its workers never call back into this module
+        // once our last parallel for loop has returned.
         delete execution_engine;
         delete context;
         // No need to delete the module - deleting the execution engine should take care of that.
@@ -43,7 +47,6 @@ public:
     ExecutionEngine *execution_engine;
     Module *module;
     LLVMContext *context;
-    void (*shutdown_thread_pool)();
 
     /** Do any target-specific module cleanup. */
     std::vector<void (*)()> cleanup_routines;
@@ -104,11 +107,11 @@ void hook_up_function_pointer(ExecutionEngine *ee, Module *mod, const string &na
     #endif
 }
 
-}
-
-void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const string &function_name) {
-
-    // Make the execution engine
+// Make an execution engine for the given module. The execution
+// engine takes ownership of the module. If fast is set, it spends as
+// little time as it can on instruction selection and scheduling.
+ExecutionEngine *make_execution_engine(Module *m, const string &mcpu, const string &mattrs,
+                                       bool soft_float_abi, bool fast = false) {
     debug(2) << "Creating new execution engine\n";
     string error_string;
 
@@ -128,7 +131,7 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     options.HonorSignDependentRoundingFPMathOption = false;
     options.UseSoftFloat = false;
     options.FloatABIType =
-        cg->use_soft_float_abi() ? FloatABI::Soft : FloatABI::Hard;
+        soft_float_abi ? FloatABI::Soft : FloatABI::Hard;
     options.NoZerosInBSS = false;
     options.GuaranteedTailCallOpt = false;
     options.DisableTailCalls = false;
@@ -149,13 +152,134 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     #else
     engine_builder.setUseMCJIT(false);
     #endif
-    engine_builder.setOptLevel(CodeGenOpt::Aggressive);
-    engine_builder.setMCPU(cg->mcpu());
-    engine_builder.setMAttrs(vec<string>(cg->mattrs()));
+    engine_builder.setOptLevel(fast ? CodeGenOpt::None : CodeGenOpt::Aggressive);
+    engine_builder.setMCPU(mcpu);
+    engine_builder.setMAttrs(vec<string>(mattrs));
     ExecutionEngine *ee = engine_builder.create();
     if (!ee) std::cerr << error_string << "\n";
     assert(ee && "Couldn't create execution engine");
 
+    return ee;
+}
+
+// The thread pool shared by all jit-compiled pipelines. It lives in
+// its own copy of the runtime, which is compiled the first time a
+// pipeline wants a thread pool and is never freed.
+struct SharedThreadPool {
+    ExecutionEngine *execution_engine;
+
+    // Everything the pipelines' runtimes forward to the shared pool,
+    // laid out as halide_set_shared_thread_pool expects.
+    struct {
+        int (*do_par_for)(void *, void *, void *, int, int, uint8_t *);
+        void (*shutdown)();
+        void (*set_num_threads)(int);
+        void (*set_spin_count)(int);
+        int (*set_concurrency_limit)(void *, int);
+        void (*set_affinity)(int);
+        void (*enable_stats)(int);
+        int (*get_stats)(void *, void *, int);
+    } functions;
+};
+
+SharedThreadPool *shared_thread_pool = NULL;
+
+// Pipelines compiled on different threads at once must not both make
+// a thread pool.
+Mutex &shared_thread_pool_mutex() {
+    static Mutex *mutex = new Mutex;
+    return *mutex;
+}
+
+#if defined(USE_MCJIT) && LLVM_VERSION >= 33
+// Hands the execution engine the object file found in the jit cache
+// instead of letting it compile the module, or saves the object file
+// it compiled if there wasn't one.
+class JITObjectCache : public ObjectCache {
+    const string &key;
+    const std::vector<char> &cached_object;
+public:
+    JITObjectCache(const string &k, const std::vector<char> &o) : key(k), cached_object(o) {}
+
+    void notifyObjectCompiled(const Module *, const MemoryBuffer *obj) {
+        if (cached_object.empty()) {
+            jit_cache_store(key, obj->getBufferStart(), obj->getBufferSize());
+        }
+    }
+
+    #if LLVM_VERSION < 35
+    MemoryBuffer *getObject(const Module *) {
+        if (cached_object.empty()) return NULL;
+        return MemoryBuffer::getMemBufferCopy(StringRef(&cached_object[0], cached_object.size()));
+    }
+    #else
+    std::unique_ptr<MemoryBuffer> getObject(const Module *) {
+        if (cached_object.empty()) return NULL;
+        return std::unique_ptr<MemoryBuffer>(MemoryBuffer::getMemBufferCopy(StringRef(&cached_object[0], cached_object.size())));
+    }
+    #endif
+};
+#endif
+
+SharedThreadPool *get_shared_thread_pool(CodeGen *cg, Module *pipeline) {
+    ScopedLock lock(shared_thread_pool_mutex());
+    if (shared_thread_pool) return shared_thread_pool;
+
+    debug(1) << "Compiling the shared JIT thread pool\n";
+    Target t = get_jit_target_from_environment();
+    LLVMContext *context = new LLVMContext();
+    Module *m = get_initial_module_for_target(Target(t.os, t.arch, t.bits, Target::JIT), context);
+    m->setTargetTriple(pipeline->getTargetTriple());
+
+    ExecutionEngine *ee = make_execution_engine(m, cg->mcpu(), cg->mattrs(), cg->use_soft_float_abi());
+
+    #ifdef __arm__
+    start = end = NULL;
+    #endif
+
+    SharedThreadPool *pool = new SharedThreadPool;
+    pool->execution_engine = ee;
+    hook_up_function_pointer(ee, m, "halide_thread_pool_do_par_for", true, &pool->functions.do_par_for);
+    hook_up_function_pointer(ee, m, "halide_thread_pool_shutdown", true, &pool->functions.shutdown);
+    hook_up_function_pointer(ee, m, "halide_set_num_threads", true, &pool->functions.set_num_threads);
+    hook_up_function_pointer(ee, m, "halide_set_thread_pool_spin_count", true, &pool->functions.set_spin_count);
+    hook_up_function_pointer(ee, m, "halide_set_concurrency_limit", true, &pool->functions.set_concurrency_limit);
+    hook_up_function_pointer(ee, m, "halide_set_thread_pool_affinity", true, &pool->functions.set_affinity);
+    hook_up_function_pointer(ee, m, "halide_enable_thread_pool_stats", true, &pool->functions.enable_stats);
+    hook_up_function_pointer(ee, m, "halide_get_thread_pool_stats", true, &pool->functions.get_stats);
+    ee->finalizeObject();
+
+    #ifdef __arm__
+    __clear_cache(start, end);
+    #endif
+
+    shared_thread_pool = pool;
+    return pool;
+}
+
+}
+
+void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const string &function_name) {
+
+    // Runtimes with a thread pool of their own defer to the shared
+    // one. Make sure it exists before we start compiling this module.
+    SharedThreadPool *pool = NULL;
+    if (m->getFunction("halide_set_shared_thread_pool")) {
+        pool = get_shared_thread_pool(cg, m);
+    }
+
+    ExecutionEngine *ee = make_execution_engine(m, cg->mcpu(), cg->mattrs(), cg->use_soft_float_abi(),
+                                                cg->get_fast_compile());
+
+    #if defined(USE_MCJIT) && LLVM_VERSION >= 33
+    // The module gets compiled when we first look up a function in
+    // it below, so the cache only needs to live until then.
+    JITObjectCache object_cache(cg->get_jit_cache_key(), cg->get_jit_cached_object());
+    if (!cg->get_jit_cache_key().empty()) {
+        ee->setObjectCache(&object_cache);
+    }
+    #endif
+
     #ifdef __arm__
     start = end = NULL;
     #endif
@@ -182,16 +306,38 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     hook_up_function_pointer(ee, m, "halide_set_custom_do_task", true, &set_custom_do_task);
     hook_up_function_pointer(ee, m, "halide_set_custom_trace", true, &set_custom_trace);
     hook_up_function_pointer(ee, m, "halide_shutdown_thread_pool", true, &shutdown_thread_pool);
+    hook_up_function_pointer(ee, m, "halide_do_batch", true, &do_batch);
+
+    void (*set_shared_thread_pool)(const void *);
+    hook_up_function_pointer(ee, m, "halide_set_shared_thread_pool", false, &set_shared_thread_pool);
+
+    void (*allocator_trim)();
+    hook_up_function_pointer(ee, m, "halide_allocator_trim", false, &allocator_trim);
 
     debug(2) << "Finalizing object\n";
     ee->finalizeObject();
 
+    #if defined(USE_MCJIT) && LLVM_VERSION >= 33
+    ee->setObjectCache(NULL);
+    #endif
+
     // Stash the various objects that need to stay alive behind a reference-counted pointer.
-    module = new JITModuleHolder(ee, m, shutdown_thread_pool);
+    module = new JITModuleHolder(ee, m);
+
+    if (set_shared_thread_pool) {
+        assert(pool);
+        set_shared_thread_pool(&pool->functions);
+    }
 
     // Do any target-specific post-compilation module meddling
     cg->jit_finalize(ee, m, &module.ptr->cleanup_routines);
 
+    // Give back any memory the allocator is holding on to for reuse
+    // once the module goes away.
+    if (allocator_trim) {
+        module.ptr->cleanup_routines.push_back(allocator_trim);
+    }
+
     #ifdef __arm__
     // Flush each function from the dcache so that it gets pulled into
     // the icache correctly.
@@ -212,5 +358,12 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
 
 }
 
+void shutdown_jit_thread_pool() {
+    ScopedLock lock(shared_thread_pool_mutex());
+    if (shared_thread_pool) {
+        shared_thread_pool->functions.shutdown();
+    }
+}
+
 }
 }
@@ -68,11 +68,17 @@ struct JITCompiledModule {
     typedef int (*TraceFn)(void *, const char *, int, int, int, int, int, int, const void *, int, const int *);
     void (*set_custom_trace)(TraceFn);
 
-    /** Shutdown the thread pool maintained by this JIT module. This
-     * is also done automatically when the last reference to this
-     * module is destroyed. */
+    /** Shutdown the thread pool used by this JIT module. On platforms
+     * where the runtime maintains its own thread pool, this is the
+     * pool shared by all JIT modules in the process, so it is not
+     * shut down when this module is destroyed. It restarts the next
+     * time any pipeline needs it. */
     void (*shutdown_thread_pool)();
 
+    /** Call wrapped_function once per argument list, in parallel on
+     * the thread pool. See \ref Func::realize_batch */
+    int (*do_batch)(void *user_context, int (*)(const void **), const void ***args, int size);
+
     // The JIT Module Allocator holds onto the memory storing the functions above.
     IntrusivePtr<JITModuleHolder> module;
 
@@ -87,7 +93,8 @@ struct JITCompiledModule {
         set_custom_do_par_for(NULL),
         set_custom_do_task(NULL),
         set_custom_trace(NULL),
-        shutdown_thread_pool(NULL) {}
+        shutdown_thread_pool(NULL),
+        do_batch(NULL) {}
 
     /** Take an llvm module and compile it. Populates the function
      * pointer members above with the result. */
@@ -95,6 +102,11 @@ struct JITCompiledModule {
 
 };
 
+/** Shut down the thread pool shared by all JIT-compiled pipelines, if
+ * it has been started. It starts again, reading HL_NUMTHREADS anew,
+ * the next time a pipeline runs a parallel loop. */
+EXPORT void shutdown_jit_thread_pool();
+
 }
 }
 
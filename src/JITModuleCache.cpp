@@ -0,0 +1,349 @@
+#include "JITModuleCache.h"
+#include "JITCache.h"
+#include "IRMutator.h"
+#include "IRPrinter.h"
+#include "Lower.h"
+#include "StackAllocation.h"
+#include "AllocationTracking.h"
+#include "Debug.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace Halide {
+
+using std::string;
+using std::vector;
+using std::map;
+using std::set;
+using std::ostringstream;
+
+namespace {
+
+struct CacheEntry {
+    Internal::JITCompiledModule module;
+    uint64_t last_used;
+};
+
+// Set by set_jit_module_cache_size. Until then it comes from
+// HL_JIT_MODULE_CACHE_SIZE.
+int jit_module_cache_size = -1;
+map<string, CacheEntry> jit_module_cache;
+uint64_t jit_module_cache_clock = 0;
+JITModuleCacheStats jit_module_cache_stats = {0, 0, 0, 0};
+
+// Guards all of the above, because Funcs may be compiled on several
+// threads at once.
+Internal::Mutex &jit_module_cache_mutex() {
+    static Internal::Mutex *mutex = new Internal::Mutex;
+    return *mutex;
+}
+
+int get_jit_module_cache_size() {
+    if (jit_module_cache_size < 0) {
+        char *size = getenv("HL_JIT_MODULE_CACHE_SIZE");
+        jit_module_cache_size = size ? atoi(size) : 32;
+    }
+    return jit_module_cache_size;
+}
+
+void evict_jit_modules(int max_entries) {
+    while ((int)jit_module_cache.size() > max_entries) {
+        map<string, CacheEntry>::iterator oldest = jit_module_cache.begin();
+        for (map<string, CacheEntry>::iterator iter = jit_module_cache.begin();
+             iter != jit_module_cache.end(); ++iter) {
+            if (iter->second.last_used < oldest->second.last_used) {
+                oldest = iter;
+            }
+        }
+        jit_module_cache.erase(oldest);
+        jit_module_cache_stats.evictions++;
+    }
+}
+
+}
+
+void set_jit_module_cache_size(int entries) {
+    Internal::ScopedLock lock(jit_module_cache_mutex());
+    jit_module_cache_size = entries;
+    evict_jit_modules(entries);
+}
+
+JITModuleCacheStats get_jit_module_cache_stats() {
+    Internal::ScopedLock lock(jit_module_cache_mutex());
+    JITModuleCacheStats stats = jit_module_cache_stats;
+    stats.entries = (int)jit_module_cache.size();
+    return stats;
+}
+
+void clear_jit_module_cache() {
+    Internal::ScopedLock lock(jit_module_cache_mutex());
+    jit_module_cache.clear();
+}
+
+namespace Internal {
+
+namespace {
+
+// Replace names that the user or lowering made up with ones numbered
+// in order of first appearance. Names are dot-separated lists of
+// parts, and only the parts in the given set get renamed. The others
+// (e.g. the "min" in "f.s0.x.min") mean something to codegen, so
+// they stay as they are.
+class CanonicalizeNames : public IRMutator {
+public:
+    CanonicalizeNames(const set<string> &n) : names(n) {}
+
+    string rename(const string &name) {
+        string result;
+        size_t start = 0;
+        while (start <= name.size()) {
+            size_t end = name.find('.', start);
+            if (end == string::npos) end = name.size();
+            if (start > 0) result += '.';
+            result += rename_part(name.substr(start, end - start));
+            start = end + 1;
+        }
+        return result;
+    }
+
+    // Rename the names that appear as words in an error message.
+    string rename_message(const string &message) {
+        string result;
+        size_t i = 0;
+        while (i < message.size()) {
+            size_t j = i;
+            while (j < message.size() && (isalnum(message[j]) || message[j] == '_' || message[j] == '$')) {
+                j++;
+            }
+            if (j > i) {
+                result += rename_part(message.substr(i, j - i));
+                i = j;
+            } else {
+                result += message[i++];
+            }
+        }
+        return result;
+    }
+
+private:
+    using IRMutator::visit;
+
+    const set<string> &names;
+    map<string, string> renamed;
+
+    string rename_part(const string &part) {
+        if (!names.count(part)) return part;
+        map<string, string>::iterator iter = renamed.find(part);
+        if (iter != renamed.end()) return iter->second;
+        string new_name = "$" + int_to_string((int)renamed.size());
+        renamed[part] = new_name;
+        return new_name;
+    }
+
+    void visit(const Variable *op) {
+        expr = Variable::make(op->type, rename(op->name), op->param, op->reduction_domain);
+    }
+
+    void visit(const Load *op) {
+        Expr index = mutate(op->index);
+        expr = Load::make(op->type, rename(op->name), index, op->image, op->param);
+    }
+
+    void visit(const Call *op) {
+        IRMutator::visit(op);
+        // Extern calls and intrinsics are looked up by name.
+        if (op->call_type == Call::Halide || op->call_type == Call::Image) {
+            const Call *c = expr.as<Call>();
+            expr = Call::make(c->type, rename(c->name), c->args, c->call_type,
+                              c->func, c->value_index, c->image, c->param);
+        }
+    }
+
+    void visit(const Let *op) {
+        string name = rename(op->name);
+        Expr value = mutate(op->value);
+        expr = Let::make(name, value, mutate(op->body));
+    }
+
+    void visit(const LetStmt *op) {
+        string name = rename(op->name);
+        Expr value = mutate(op->value);
+        stmt = LetStmt::make(name, value, mutate(op->body));
+    }
+
+    void visit(const AssertStmt *op) {
+        stmt = AssertStmt::make(mutate(op->condition), rename_message(op->message));
+    }
+
+    void visit(const Pipeline *op) {
+        string name = rename(op->name);
+        Stmt produce = mutate(op->produce);
+        Stmt update = op->update.defined() ? mutate(op->update) : Stmt();
+        stmt = Pipeline::make(name, produce, update, mutate(op->consume));
+    }
+
+    void visit(const For *op) {
+        string name = rename(op->name);
+        Expr min = mutate(op->min);
+        Expr extent = mutate(op->extent);
+        stmt = For::make(name, min, extent, op->for_type, mutate(op->body));
+    }
+
+    void visit(const Store *op) {
+        string name = rename(op->name);
+        Expr value = mutate(op->value);
+        stmt = Store::make(name, value, mutate(op->index));
+    }
+
+    void visit(const Allocate *op) {
+        string name = rename(op->name);
+        Expr size = mutate(op->size);
+        stmt = Allocate::make(name, op->type, size, mutate(op->body), op->on_stack);
+    }
+
+    void visit(const Free *op) {
+        stmt = Free::make(rename(op->name));
+    }
+};
+
+// Names bound by lets, loops, and allocations that lowering made up
+// (e.g. the temporaries introduced by CSE) are single words.
+class FindTemporaries : public IRVisitor {
+public:
+    set<string> &names;
+    FindTemporaries(set<string> &n) : names(n) {}
+
+private:
+    using IRVisitor::visit;
+
+    void add(const string &name) {
+        if (name.find('.') == string::npos) {
+            names.insert(name);
+        }
+    }
+
+    void visit(const Let *op) {
+        add(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const LetStmt *op) {
+        add(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const For *op) {
+        add(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const Allocate *op) {
+        add(op->name);
+        IRVisitor::visit(op);
+    }
+};
+
+void add_schedule_names(const Schedule &s, set<string> &names) {
+    for (size_t i = 0; i < s.splits.size(); i++) {
+        names.insert(s.splits[i].old_var);
+        names.insert(s.splits[i].outer);
+        names.insert(s.splits[i].inner);
+    }
+    for (size_t i = 0; i < s.dims.size(); i++) {
+        names.insert(s.dims[i].var);
+    }
+    for (size_t i = 0; i < s.storage_dims.size(); i++) {
+        names.insert(s.storage_dims[i]);
+    }
+}
+
+}
+
+string jit_module_cache_key(Stmt s, Function f, const vector<Argument> &args, const Target &t) {
+    {
+        ScopedLock lock(jit_module_cache_mutex());
+        if (get_jit_module_cache_size() == 0) {
+            return "";
+        }
+    }
+
+    // Everything the user named: the functions in the pipeline, their
+    // variables, and the arguments.
+    set<string> names;
+    map<string, Function> env;
+    populate_environment(f, env);
+    for (map<string, Function>::iterator iter = env.begin(); iter != env.end(); ++iter) {
+        Function g = iter->second;
+        names.insert(g.name());
+        names.insert(g.args().begin(), g.args().end());
+        add_schedule_names(g.schedule(), names);
+        for (size_t i = 0; i < g.reductions().size(); i++) {
+            const ReductionDefinition &r = g.reductions()[i];
+            add_schedule_names(r.schedule, names);
+            if (r.domain.defined()) {
+                for (size_t j = 0; j < r.domain.domain().size(); j++) {
+                    names.insert(r.domain.domain()[j].var);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < args.size(); i++) {
+        names.insert(args[i].name);
+    }
+
+    FindTemporaries temporaries(names);
+    s.accept(&temporaries);
+
+    CanonicalizeNames canonicalize(names);
+
+    ostringstream key;
+    // Codegen also depends on these
+    key << "target " << t.os << " " << t.arch << " " << t.bits << " " << t.features << "\n"
+        << "max stack allocation " << max_stack_allocation_bytes() << "\n"
+        << "track allocations " << allocation_tracking_enabled() << "\n";
+    for (size_t i = 0; i < args.size(); i++) {
+        key << "argument " << canonicalize.rename(args[i].name) << " "
+            << args[i].is_buffer << " " << args[i].type << "\n";
+    }
+    print_for_jit_cache_key(key, canonicalize.mutate(s));
+    return key.str();
+}
+
+bool jit_module_cache_lookup(const string &key, JITCompiledModule *module) {
+    if (key.empty()) return false;
+
+    ScopedLock lock(jit_module_cache_mutex());
+    map<string, CacheEntry>::iterator iter = jit_module_cache.find(key);
+    if (iter == jit_module_cache.end()) {
+        jit_module_cache_stats.misses++;
+        return false;
+    }
+
+    debug(1) << "Reusing a pipeline jit-compiled earlier\n";
+    jit_module_cache_stats.hits++;
+    iter->second.last_used = ++jit_module_cache_clock;
+    *module = iter->second.module;
+    return true;
+}
+
+void jit_module_cache_store(const string &key, const JITCompiledModule &module) {
+    ScopedLock lock(jit_module_cache_mutex());
+    int max_entries = get_jit_module_cache_size();
+    if (key.empty() || max_entries == 0) return;
+
+    CacheEntry entry;
+    entry.module = module;
+    entry.last_used = ++jit_module_cache_clock;
+    jit_module_cache[key] = entry;
+
+    evict_jit_modules(max_entries);
+}
+
+}
+}
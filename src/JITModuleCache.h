@@ -0,0 +1,79 @@
+#ifndef HALIDE_JIT_MODULE_CACHE_H
+#define HALIDE_JIT_MODULE_CACHE_H
+
+/** \file
+ * Defines the in-process cache of jit-compiled pipelines
+ */
+
+#include "IR.h"
+#include "Argument.h"
+#include "Target.h"
+#include "JITCompiledModule.h"
+
+#include <string>
+#include <vector>
+
+namespace Halide {
+
+/** Counters describing the in-process cache of jit-compiled
+ * pipelines. See \ref get_jit_module_cache_stats */
+struct JITModuleCacheStats {
+    /** How many times compiling a pipeline reused the machine code of
+     * an earlier one, or had to compile it */
+    // @{
+    int hits, misses;
+    // @}
+
+    /** How many pipelines were dropped from the cache to make room
+     * for others */
+    int evictions;
+
+    /** How many pipelines are in the cache now */
+    int entries;
+};
+
+/** Set how many jit-compiled pipelines to keep around for reuse by
+ * later Funcs that lower to the same thing, up to a renaming of
+ * Funcs, Vars, and parameters. When the cache is full the least
+ * recently used pipeline is dropped. Overrides the environment
+ * variable HL_JIT_MODULE_CACHE_SIZE. The default is 32. Zero turns
+ * the cache off.
+ *
+ * Funcs that share machine code also share the runtime state of the
+ * pipeline (e.g. its allocator cache), and error messages name the
+ * buffers of the Func that was compiled first. Handlers such as
+ * the error handler and custom allocator are part of that state, so
+ * Funcs that set any of them always compile code of their own. */
+EXPORT void set_jit_module_cache_size(int entries);
+
+/** Get the hit, miss, and eviction counts of the cache of
+ * jit-compiled pipelines since the process started. */
+EXPORT JITModuleCacheStats get_jit_module_cache_stats();
+
+/** Drop every pipeline in the cache of jit-compiled pipelines. Funcs
+ * already using them keep them alive. */
+EXPORT void clear_jit_module_cache();
+
+namespace Internal {
+
+/** Make a key that identifies the machine code for a lowered pipeline
+ * compiled for the given target. Names of Funcs, Vars, parameters,
+ * and temporaries are replaced with names numbered in order of
+ * appearance, so that pipelines built the same way get the same
+ * key. Returns the empty string if the cache is off. */
+std::string jit_module_cache_key(Stmt s, Function f,
+                                 const std::vector<Argument> &args,
+                                 const Target &t);
+
+/** Find the module compiled earlier for a key made by \ref
+ * jit_module_cache_key. Counts as a hit or a miss. */
+bool jit_module_cache_lookup(const std::string &key, JITCompiledModule *module);
+
+/** Add a module to the cache, evicting the least recently used one
+ * if it's full. */
+void jit_module_cache_store(const std::string &key, const JITCompiledModule &module);
+
+}
+}
+
+#endif
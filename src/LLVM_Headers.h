@@ -14,6 +14,9 @@
 
 #ifdef USE_MCJIT
 #include <llvm/ExecutionEngine/MCJIT.h>
+#if LLVM_VERSION >= 33
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#endif
 #else
 #include <llvm/ExecutionEngine/JIT.h>
 #endif
@@ -33,6 +36,7 @@
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Target/TargetLibraryInfo.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/IPO.h>
@@ -14,16 +14,20 @@
 #include "Debug.h"
 #include "Tracing.h"
 #include "Profiling.h"
+#include "AllocationTracking.h"
 #include "StorageFlattening.h"
 #include "BoundsInference.h"
 #include "VectorizeLoops.h"
 #include "UnrollLoops.h"
 #include "SlidingWindow.h"
 #include "StorageFolding.h"
+#include "StorageSharing.h"
+#include "StackAllocation.h"
 #include "RemoveTrivialForLoops.h"
 #include "Deinterleave.h"
 #include "DebugToFile.h"
 #include "EarlyFree.h"
+#include "ScratchArena.h"
 #include "UniquifyVariableNames.h"
 #include "SkipStages.h"
 #include "CSE.h"
@@ -792,7 +796,7 @@ public:
     }
 };
 
-void populate_environment(Function f, map<string, Function> &env, bool recursive = true) {
+void populate_environment(Function f, map<string, Function> &env, bool recursive) {
     map<string, Function>::const_iterator iter = env.find(f.name());
     if (iter != env.end()) {
         assert(iter->second.same_as(f) &&
@@ -1525,7 +1529,21 @@ Stmt add_image_checks(Stmt s, Function f) {
     return s;
 }
 
-Stmt lower(Function f) {
+bool param_value_in_range(Parameter p, Expr value) {
+    if (p.get_min_value().defined() &&
+        is_zero(simplify(value >= p.get_min_value()))) {
+        return false;
+    }
+    if (p.get_max_value().defined() &&
+        is_zero(simplify(value <= p.get_max_value()))) {
+        return false;
+    }
+    return true;
+}
+
+namespace {
+// Lower a function with its current schedule
+Stmt lower_with_schedule(Function f, const map<string, Expr> &param_values) {
 
     // Compute an environment
     map<string, Function> env;
@@ -1548,10 +1566,23 @@ Stmt lower(Function f) {
     s = inject_profiling(s, f.name());
     debug(2) << "Profiling injected:\n" << s << '\n';
 
+    debug(1) << "Injecting allocation tracking...\n";
+    s = inject_allocation_tracking(s, f.name());
+    debug(2) << "Allocation tracking injected:\n" << s << '\n';
+
     debug(1) << "Adding checks for parameters\n";
     s = add_parameter_checks(s);
     debug(2) << "Parameter checks injected:\n" << s << '\n';
 
+    // Substitute in the parameter values after the checks are built,
+    // so that they still clamp and check the values. The checks then
+    // fold away.
+    if (!param_values.empty()) {
+        debug(1) << "Substituting in parameter values...\n";
+        s = substitute(param_values, s);
+        debug(2) << "Parameter values substituted:\n" << s << '\n';
+    }
+
     // The checks will be in terms of the symbols defined by bounds
     // inference.
     debug(1) << "Adding checks for images\n";
@@ -1573,6 +1604,12 @@ Stmt lower(Function f) {
     s = allocation_bounds_inference(s, env);
     debug(2) << "Allocation bounds inference:\n" << s << '\n';
 
+    // Bounds inference pulls in expressions from the function
+    // definitions, which may use the parameters too.
+    if (!param_values.empty()) {
+        s = substitute(param_values, s);
+    }
+
     // This uniquifies the variable names, so we're good to simplify
     // after this point. This lets later passes assume syntactic
     // equivalence means semantic equivalence.
@@ -1600,6 +1637,12 @@ Stmt lower(Function f) {
     s = storage_flattening(s, env);
     debug(2) << "Storage flattening: \n" << s << "\n\n";
 
+    // Storage flattening refers to the strides and mins of the input
+    // and output buffers, which a specialization may have values for.
+    if (!param_values.empty()) {
+        s = substitute(param_values, s);
+    }
+
     debug(1) << "Removing code that depends on undef values...\n";
     s = remove_undef(s);
     debug(2) << "Removed code that depends on undef values: \n" << s << "\n\n;";
@@ -1610,6 +1653,14 @@ Stmt lower(Function f) {
     s = remove_trivial_for_loops(s);
     debug(2) << "Simplified: \n" << s << "\n\n";
 
+    debug(1) << "Bounding allocations to put on the stack...\n";
+    s = bound_stack_allocations(s);
+    debug(2) << "Bounded allocations to put on the stack: \n" << s << "\n\n";
+
+    debug(1) << "Sharing storage between buffers...\n";
+    s = share_storage(s);
+    debug(2) << "Shared storage between buffers: \n" << s << "\n\n";
+
     debug(1) << "Unrolling...\n";
     s = unroll_loops(s);
     debug(2) << "Unrolled: \n" << s << "\n\n";
@@ -1639,6 +1690,10 @@ Stmt lower(Function f) {
     s = inject_early_frees(s);
     debug(2) << "Injected early frees: \n" << s << "\n\n";
 
+    debug(1) << "Grouping allocations into arenas...\n";
+    s = inject_scratch_arenas(s);
+    debug(2) << "Grouped allocations into arenas: \n" << s << "\n\n";
+
     debug(1) << "Simplifying...\n";
     s = common_subexpression_elimination(s);
     s = simplify(s);
@@ -1647,5 +1702,61 @@ Stmt lower(Function f) {
     return s;
 }
 
+// Add the values of any parameters implied by a condition being
+// true to the map.
+void learn_from_condition(Expr cond, map<string, Expr> &values) {
+    if (const And *a = cond.as<And>()) {
+        learn_from_condition(a->a, values);
+        learn_from_condition(a->b, values);
+    } else if (const EQ *eq = cond.as<EQ>()) {
+        const Variable *var = eq->a.as<Variable>();
+        if (var && var->param.defined() && is_const(eq->b) &&
+            param_value_in_range(var->param, eq->b)) {
+            values[var->name] = eq->b;
+        }
+    } else if (const Not *n = cond.as<Not>()) {
+        const Variable *var = n->a.as<Variable>();
+        if (var && var->param.defined()) {
+            values[var->name] = const_false();
+        }
+    } else if (const Variable *var = cond.as<Variable>()) {
+        if (var->param.defined()) {
+            values[var->name] = const_true();
+        }
+    }
+}
+}
+
+Stmt lower(Function f, const map<string, Expr> &param_values) {
+    Stmt s = lower_with_schedule(f, param_values);
+
+    // Lower the pipeline again for each specialization of the output
+    // schedule, and select between them at the top. The first
+    // condition that holds wins, so wrap them around the generic
+    // version in reverse order.
+    const vector<Specialization> &specializations = f.specializations();
+    for (size_t i = specializations.size(); i > 0; i--) {
+        const Specialization &spec = specializations[i-1];
+        Expr cond = simplify(substitute(param_values, spec.condition));
+        if (is_zero(cond)) continue;
+
+        debug(1) << "Lowering " << f.name() << " specialized to " << cond << "\n";
+        map<string, Expr> values = param_values;
+        learn_from_condition(cond, values);
+
+        // Lower a copy with the specialized schedule, so that other
+        // threads lowering pipelines that use f don't see it.
+        Stmt then_case = lower_with_schedule(f.with_pure_schedule(spec.schedule), values);
+
+        if (is_one(cond)) {
+            s = then_case;
+        } else {
+            s = IfThenElse::make(cond, then_case, s);
+        }
+    }
+
+    return s;
+}
+
 }
 }
@@ -10,13 +10,32 @@
 #include "IR.h"
 #include "Func.h"
 
+#include <map>
+
 namespace Halide {
 namespace Internal {
 
 /** Given a halide function with a schedule, create a statement that
  * evaluates it. Automatically pulls in all the functions f depends
- * on */
-Stmt lower(Function f);
+ * on. Any scalar parameters or buffer fields named in param_values
+ * are replaced with the given values after the checks on parameter
+ * ranges are built, but before bounds inference, so that everything
+ * after it can take advantage of them. If f has
+ * specializations of its schedule, the pipeline is lowered once for
+ * each, and once more for the generic case, and the results are
+ * selected between at the top of the statement. */
+Stmt lower(Function f, const std::map<std::string, Expr> &param_values = std::map<std::string, Expr>());
+
+/** Check whether a constant value for a scalar parameter is within
+ * the parameter's min and max. Values that aren't shouldn't be passed
+ * to lower in param_values, or its range checks would fail while
+ * compiling, instead of reporting the error when the pipeline runs. */
+bool param_value_in_range(Parameter p, Expr value);
+
+/** Add f and the functions it calls to the given map, keyed by
+ * name. If recursive is false, add only the functions f calls
+ * directly, and not f itself. */
+void populate_environment(Function f, std::map<std::string, Function> &env, bool recursive = true);
 
 void lower_test();
 
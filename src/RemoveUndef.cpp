@@ -338,7 +338,7 @@ class RemoveUndef : public IRMutator {
         if (size.same_as(op->size) && body.same_as(op->body)) {
             stmt = op;
         } else {
-            stmt = Allocate::make(op->name, op->type, size, body);
+            stmt = Allocate::make(op->name, op->type, size, body, op->on_stack);
         }
     }
 
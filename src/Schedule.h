@@ -120,6 +120,12 @@ struct Schedule {
     /** You may explicitly bound some of the dimensions of a
      * function. See \ref ScheduleHandle::bound */
     std::vector<Bound> bounds;
+
+    /** Should the storage for this function go on the stack, however
+     * big it is? See \ref Func::store_in_stack */
+    bool store_in_stack;
+
+    Schedule() : store_in_stack(false) {}
 };
 
 }
@@ -0,0 +1,310 @@
+#include "ScratchArena.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "IREquality.h"
+#include "Substitute.h"
+#include "CodeGen_GPU_Dev.h"
+#include "StackAllocation.h"
+#include "Debug.h"
+#include <map>
+#include <utility>
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::string;
+using std::vector;
+using std::pair;
+using std::make_pair;
+
+namespace {
+
+// Is a buffer touched inside a gpu kernel? Those are allocated
+// separately on the device, and may not need host memory at all.
+class UsedOnDevice : public IRVisitor {
+public:
+    bool result;
+    UsedOnDevice(const string &b) : result(false), buffer(b), in_kernel(false) {}
+
+private:
+    using IRVisitor::visit;
+    string buffer;
+    bool in_kernel;
+
+    void visit(const For *op) {
+        bool old_in_kernel = in_kernel;
+        in_kernel = in_kernel || CodeGen_GPU_Dev::is_gpu_var(op->name);
+        IRVisitor::visit(op);
+        in_kernel = old_in_kernel;
+    }
+
+    void visit(const Load *op) {
+        result = result || (in_kernel && op->name == buffer);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const Store *op) {
+        result = result || (in_kernel && op->name == buffer);
+        IRVisitor::visit(op);
+    }
+};
+
+// The size in bytes of an allocation, if it's worth putting in an
+// arena, or an undefined Expr if it isn't.
+Expr arena_bytes(const Allocate *op, Expr size) {
+    // Small allocations with a constant size go on the stack (see
+    // CodeGen_Posix::create_allocation), so there's nothing to gain
+    // by putting them in an arena.
+    Expr bytes = size * op->type.bytes();
+    const IntImm *const_bytes = bytes.as<IntImm>();
+    if (op->on_stack || (const_bytes && const_bytes->value <= max_stack_allocation_bytes())) {
+        return Expr();
+    }
+
+    // We substitute in any lets between the top of the arena and the
+    // allocation, so the size can be evaluated at the top of the arena
+    // as long as it doesn't depend on memory.
+    if (reads_memory(bytes)) {
+        return Expr();
+    }
+
+    UsedOnDevice used_on_device(op->name);
+    op->body.accept(&used_on_device);
+    if (used_on_device.result) {
+        return Expr();
+    }
+
+    // Keep every member as aligned as halide_malloc would.
+    return ((bytes + 31) / 32) * 32;
+}
+
+struct ArenaMember {
+    const Allocate *op;
+    Expr bytes;
+    // The positions in program order at which the buffer is
+    // allocated and freed.
+    int start, end;
+};
+
+// Find the allocations in the body of an allocation that happen at
+// the same loop level, and when each one is freed. Allocations inside
+// for loops happen once per iteration, so they get their own arenas
+// inside the loop body.
+class FindArenaMembers : public IRVisitor {
+public:
+    vector<ArenaMember> members;
+
+    FindArenaMembers() : position(0) {}
+
+    void add(const Allocate *op, Expr bytes) {
+        ArenaMember m = {op, bytes, position++, -1};
+        members.push_back(m);
+    }
+
+private:
+    using IRVisitor::visit;
+
+    int position;
+
+    // The lets between the top of the arena and the current
+    // statement, innermost last.
+    vector<pair<string, Expr> > lets;
+
+    void visit(const For *op) {
+    }
+
+    void visit(const LetStmt *op) {
+        lets.push_back(make_pair(op->name, op->value));
+        op->body.accept(this);
+        lets.pop_back();
+    }
+
+    void visit(const Allocate *op) {
+        // Express the size in terms of things defined at the top of
+        // the arena.
+        Expr size = op->size;
+        for (size_t i = lets.size(); i > 0; i--) {
+            size = substitute(lets[i-1].first, lets[i-1].second, size);
+        }
+
+        Expr bytes = arena_bytes(op, size);
+        if (bytes.defined()) {
+            add(op, bytes);
+        }
+
+        op->body.accept(this);
+    }
+
+    void visit(const Free *op) {
+        for (size_t i = 0; i < members.size(); i++) {
+            if (members[i].op->name == op->name) {
+                members[i].end = position++;
+            }
+        }
+    }
+};
+
+class InjectScratchArenas : public IRMutator {
+    using IRMutator::visit;
+
+    // For each allocation that lives in an arena, the name of the
+    // arena and the variable holding its offset within it. Keyed by
+    // the Allocate node, because different branches of an if (see
+    // Func::specialize) may allocate buffers with the same name.
+    map<const Allocate *, pair<string, string> > placement;
+
+    // False while making the version of some code that allocates
+    // everything separately.
+    bool grouping;
+
+    // Wrap an allocation that lives in an arena in the definition of
+    // its address.
+    Stmt place_in_arena(const Allocate *op) {
+        IRMutator::visit(op);
+        const pair<string, string> &p = placement[op];
+        Expr offset = Variable::make(Int(32), p.second);
+        Expr ptr = Call::make(Handle(), Call::address_of,
+                              vec(Load::make(UInt(8), p.first, offset, Buffer(), Parameter())),
+                              Call::Intrinsic);
+        return LetStmt::make(op->name + ".arena_ptr", ptr, stmt);
+    }
+
+    void visit(const Allocate *op) {
+        if (placement.count(op)) {
+            stmt = place_in_arena(op);
+            return;
+        }
+
+        Expr bytes = grouping ? arena_bytes(op, op->size) : Expr();
+        if (!bytes.defined()) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        FindArenaMembers find;
+        find.add(op, bytes);
+        op->body.accept(&find);
+        const vector<ArenaMember> &members = find.members;
+
+        if (members.size() < 2) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        // Assign each member to a slot in the arena. A buffer that's
+        // allocated after another one has been freed can use the same
+        // slot, growing it if need be. Prefer slots that are already
+        // the right size.
+        string arena = op->name + ".arena";
+        vector<Expr> slot_bytes;
+        vector<int> slot_free_at;
+        vector<int> member_slot;
+        for (size_t i = 0; i < members.size(); i++) {
+            const ArenaMember &m = members[i];
+            int slot = -1;
+            for (size_t j = 0; j < slot_bytes.size(); j++) {
+                if (slot_free_at[j] < 0 || slot_free_at[j] > m.start) continue;
+                if (equal(slot_bytes[j], m.bytes)) {
+                    slot = (int)j;
+                    break;
+                } else if (slot < 0) {
+                    slot = (int)j;
+                }
+            }
+            if (slot < 0) {
+                slot = (int)slot_bytes.size();
+                slot_bytes.push_back(m.bytes);
+                slot_free_at.push_back(m.end);
+            } else {
+                if (!equal(slot_bytes[slot], m.bytes)) {
+                    slot_bytes[slot] = max(slot_bytes[slot], m.bytes);
+                }
+                slot_free_at[slot] = m.end;
+            }
+            member_slot.push_back(slot);
+        }
+
+        // The size of the arena is an int32, like that of any other
+        // allocation, but the members may add up to more than that.
+        // If the sizes are known, check now. Otherwise check the
+        // total in 64 bits at runtime, and allocate the members
+        // separately if it's too big.
+        const int64_t max_bytes = 0x7fffffff;
+        bool known_to_fit = true;
+        int64_t const_total = 0;
+        for (size_t j = 0; j < slot_bytes.size(); j++) {
+            const IntImm *b = slot_bytes[j].as<IntImm>();
+            if (b) {
+                const_total += b->value;
+            } else {
+                known_to_fit = false;
+            }
+        }
+        if (const_total > max_bytes) {
+            debug(2) << "Not grouping allocations into " << arena << ", because it would be too large\n";
+            IRMutator::visit(op);
+            return;
+        }
+
+        for (size_t i = 0; i < members.size(); i++) {
+            debug(3) << "Placing " << members[i].op->name << " in slot " << member_slot[i] << " of " << arena << "\n";
+            placement[members[i].op] = make_pair(arena, arena + ".offset." + int_to_string(member_slot[i]));
+        }
+
+        Stmt body = place_in_arena(op);
+
+        // Done with these. Forgetting them lets us mutate the same
+        // allocations again below without putting them in the arena.
+        for (size_t i = 0; i < members.size(); i++) {
+            placement.erase(members[i].op);
+        }
+
+        // Lay the slots out one after the other.
+        Expr total = 0;
+        Expr total_64 = make_zero(Int(64));
+        vector<Expr> offsets;
+        for (size_t j = 0; j < slot_bytes.size(); j++) {
+            offsets.push_back(total);
+            Expr slot = Variable::make(Int(32), arena + ".slot." + int_to_string(j));
+            total = total + slot;
+            total_64 = total_64 + Cast::make(Int(64), slot);
+        }
+        for (size_t j = slot_bytes.size(); j > 0; j--) {
+            body = LetStmt::make(arena + ".offset." + int_to_string(j-1), offsets[j-1], body);
+        }
+
+        body = Block::make(body, Free::make(arena));
+        body = Allocate::make(arena, UInt(8), total, body);
+
+        if (!known_to_fit) {
+            grouping = false;
+            IRMutator::visit(op);
+            grouping = true;
+            Expr fits = total_64 <= Cast::make(Int(64), (int)max_bytes);
+            body = IfThenElse::make(fits, body, stmt);
+        }
+
+        for (size_t j = slot_bytes.size(); j > 0; j--) {
+            body = LetStmt::make(arena + ".slot." + int_to_string(j-1), slot_bytes[j-1], body);
+        }
+
+        debug(2) << "Grouped " << members.size() << " allocations into "
+                 << slot_bytes.size() << " slots of " << arena << "\n";
+
+        stmt = body;
+    }
+
+public:
+    InjectScratchArenas() : grouping(true) {}
+};
+
+}
+
+Stmt inject_scratch_arenas(Stmt s) {
+    return InjectScratchArenas().mutate(s);
+}
+
+}
+}
@@ -0,0 +1,30 @@
+#ifndef HALIDE_SCRATCH_ARENA_H
+#define HALIDE_SCRATCH_ARENA_H
+
+/** \file
+ * Defines the lowering pass that carves groups of allocations out of
+ * a single larger allocation.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Group the heap allocations made at the same loop level into a
+ * single allocation (an arena), so that each realization of the group
+ * costs one call to halide_malloc instead of one per buffer. Buffers
+ * whose lifetimes don't overlap (according to the markers placed by
+ * inject_early_frees) share the same part of the arena. Each member
+ * allocation is preceded by a LetStmt called name.arena_ptr that
+ * gives its address within the arena, which the code generator uses
+ * instead of allocating fresh memory. If the members might add up
+ * to more than an allocation can hold, the group is only used when
+ * they fit, which is checked at runtime if need be. Must be run
+ * after inject_early_frees. */
+Stmt inject_scratch_arenas(Stmt s);
+
+}
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include "StackAllocation.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "Bounds.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "Debug.h"
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <utility>
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::make_pair;
+
+int max_stack_allocation_bytes() {
+    char *limit = getenv("HL_MAX_STACK_ALLOCATION");
+    return limit ? atoi(limit) : 8*1024;
+}
+
+namespace {
+
+// Find a constant upper (or lower) bound on an expression, if there's
+// an obvious one. Mostly this is for sizes like min(8, w - x*8).
+bool constant_bound(Expr e, bool upper, int *result) {
+    if (const IntImm *op = e.as<IntImm>()) {
+        *result = op->value;
+        return true;
+    } else if (const Min *op = e.as<Min>()) {
+        int a, b;
+        bool have_a = constant_bound(op->a, upper, &a);
+        bool have_b = constant_bound(op->b, upper, &b);
+        if (have_a && have_b) {
+            *result = std::min(a, b);
+            return true;
+        } else if (upper && (have_a || have_b)) {
+            // The min is at most either side
+            *result = have_a ? a : b;
+            return true;
+        }
+    } else if (const Max *op = e.as<Max>()) {
+        int a, b;
+        bool have_a = constant_bound(op->a, upper, &a);
+        bool have_b = constant_bound(op->b, upper, &b);
+        if (have_a && have_b) {
+            *result = std::max(a, b);
+            return true;
+        } else if (!upper && (have_a || have_b)) {
+            // The max is at least either side
+            *result = have_a ? a : b;
+            return true;
+        }
+    } else if (const Add *op = e.as<Add>()) {
+        int a, b;
+        if (constant_bound(op->a, upper, &a) &&
+            constant_bound(op->b, upper, &b)) {
+            *result = a + b;
+            return true;
+        }
+    } else if (const Sub *op = e.as<Sub>()) {
+        // The simplifier moves constants inside mins and maxes, so
+        // the extent of a tile looks like min(x + 8, w) - min(x, w - 8).
+        // Distribute the subtraction so that the terms can cancel.
+        if (const Min *b = op->b.as<Min>()) {
+            return constant_bound(Max::make(simplify(op->a - b->a), simplify(op->a - b->b)), upper, result);
+        } else if (const Max *b = op->b.as<Max>()) {
+            return constant_bound(Min::make(simplify(op->a - b->a), simplify(op->a - b->b)), upper, result);
+        } else if (const Min *a = op->a.as<Min>()) {
+            return constant_bound(Min::make(simplify(a->a - op->b), simplify(a->b - op->b)), upper, result);
+        } else if (const Max *a = op->a.as<Max>()) {
+            return constant_bound(Max::make(simplify(a->a - op->b), simplify(a->b - op->b)), upper, result);
+        }
+
+        int a, b;
+        if (constant_bound(op->a, upper, &a) &&
+            constant_bound(op->b, !upper, &b)) {
+            *result = a - b;
+            return true;
+        }
+    } else if (const Mul *op = e.as<Mul>()) {
+        // The simplifier puts constants on the right
+        const IntImm *b = op->b.as<IntImm>();
+        int a;
+        if (b && constant_bound(op->a, (b->value >= 0) == upper, &a)) {
+            *result = a * b->value;
+            return true;
+        }
+    } else if (const Select *op = e.as<Select>()) {
+        int a, b;
+        if (constant_bound(op->true_value, upper, &a) &&
+            constant_bound(op->false_value, upper, &b)) {
+            *result = upper ? std::max(a, b) : std::min(a, b);
+            return true;
+        }
+    }
+    return false;
+}
+
+class BoundStackAllocations : public IRMutator {
+    using IRMutator::visit;
+
+    // The bounds of the enclosing loop variables.
+    Scope<Interval> loops;
+
+    // The enclosing lets, innermost last.
+    vector<pair<string, Expr> > lets;
+
+    // Express something in terms of things defined outside the
+    // enclosing lets.
+    Expr substitute_lets(Expr e) {
+        for (size_t i = lets.size(); i > 0; i--) {
+            e = substitute(lets[i-1].first, lets[i-1].second, e);
+        }
+        return simplify(e);
+    }
+
+    void visit(const LetStmt *op) {
+        lets.push_back(make_pair(op->name, op->value));
+        IRMutator::visit(op);
+        lets.pop_back();
+    }
+
+    void visit(const For *op) {
+        Interval bounds(substitute_lets(op->min),
+                        substitute_lets(op->min + op->extent - 1));
+        loops.push(op->name, bounds);
+        IRMutator::visit(op);
+        loops.pop(op->name);
+    }
+
+    void visit(const Allocate *op) {
+        IRMutator::visit(op);
+        op = stmt.as<Allocate>();
+        assert(op);
+
+        if (op->size.as<IntImm>()) return;
+
+        // Tile-sized buffers usually have a size which is a difference
+        // of expressions that cancel out once we see through the lets,
+        // so try that first. Failing that, bound it over the enclosing
+        // loops.
+        Expr bytes = substitute_lets(op->size * op->type.bytes());
+        int bound = 0;
+        bool bounded = constant_bound(bytes, true, &bound);
+        if (!bounded) {
+            Expr max = bounds_of_expr_in_scope(bytes, loops).max;
+            bounded = max.defined() && constant_bound(simplify(max), true, &bound);
+        }
+
+        if (bounded && bound >= 0 && (op->on_stack || bound <= max_stack_allocation_bytes())) {
+            debug(3) << "Bounded the size of " << op->name << " by " << bound << " bytes\n";
+            int elems = (bound + op->type.bytes() - 1) / op->type.bytes();
+            stmt = Allocate::make(op->name, op->type, elems, op->body, true);
+        } else if (op->on_stack) {
+            std::cerr << "Warning: Can't put " << op->name << " on the stack, "
+                      << "because its size can't be bounded by a constant\n";
+            stmt = Allocate::make(op->name, op->type, op->size, op->body, false);
+        }
+    }
+};
+
+}
+
+Stmt bound_stack_allocations(Stmt s) {
+    return BoundStackAllocations().mutate(s);
+}
+
+}
+}
@@ -0,0 +1,30 @@
+#ifndef HALIDE_STACK_ALLOCATION_H
+#define HALIDE_STACK_ALLOCATION_H
+
+/** \file
+ * Defines the lowering pass that moves allocations of bounded size
+ * onto the stack.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** The largest allocation, in bytes, that goes on the stack without
+ * being asked to (see Func::store_in_stack). This is 8KB, unless the
+ * environment variable HL_MAX_STACK_ALLOCATION says otherwise. */
+int max_stack_allocation_bytes();
+
+/** Find constant upper bounds on the sizes of allocations whose size
+ * isn't a constant, e.g. the buffer for a Func computed per tile of a
+ * Func split by a constant factor, which is smaller at the edges of
+ * the image. If the bound is small enough, or the buffer was asked to
+ * go on the stack, make the allocation that size and mark it as
+ * being on the stack. Must be run after storage flattening. */
+Stmt bound_stack_allocations(Stmt s);
+
+}
+}
+
+#endif
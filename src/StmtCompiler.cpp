@@ -33,6 +33,14 @@ void StmtCompiler::compile(Stmt stmt, string name,
     contents.ptr->compile(stmt, name, args, images_to_embed);
 }
 
+void StmtCompiler::set_jit_cache_key(const string &key) {
+    contents.ptr->set_jit_cache_key(key);
+}
+
+void StmtCompiler::set_fast_compile(bool fast) {
+    contents.ptr->set_fast_compile(fast);
+}
+
 void StmtCompiler::compile_to_bitcode(const string &filename) {
     contents.ptr->compile_to_bitcode(filename);
 }
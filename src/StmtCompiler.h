@@ -36,6 +36,14 @@ public:
                  const std::vector<Argument> &args,
                  const std::vector<Buffer> &images_to_embed);
 
+    /** Look for the native code in the on-disk jit cache under the
+     * given key when compiling, and save it there when compiling to
+     * function pointers if it wasn't found. See JITCache.h */
+    void set_jit_cache_key(const std::string &key);
+
+    /** Generate slower code, faster. See CodeGen::set_fast_compile */
+    void set_fast_compile(bool fast);
+
     /** Write the module to an llvm bitcode file */
     void compile_to_bitcode(const std::string &filename);
 
@@ -85,9 +85,11 @@ private:
         }
 
         vector<int> storage_permutation;
+        bool on_stack = false;
         {
             map<string, Function>::const_iterator iter = env.find(realize->name);
             assert(iter != env.end() && "Realize node refers to function not in environment");
+            on_stack = iter->second.schedule().store_in_stack;
             const vector<string> &storage_dims = iter->second.schedule().storage_dims;
             const vector<string> &args = iter->second.args();
             for (size_t i = 0; i < storage_dims.size(); i++) {
@@ -149,7 +151,7 @@ private:
             t.bits = t.bytes() * 8;
 
             // Make the allocation node
-            stmt = Allocate::make(buffer_name, t, size, stmt);
+            stmt = Allocate::make(buffer_name, t, size, stmt, on_stack);
 
             // Compute the strides
             for (int i = (int)realize->bounds.size()-1; i > 0; i--) {
@@ -0,0 +1,272 @@
+#include "StorageSharing.h"
+#include "EarlyFree.h"
+#include "AllocationTracking.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "CodeGen_GPU_Dev.h"
+#include "Debug.h"
+#include <stdlib.h>
+#include <utility>
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::make_pair;
+
+namespace {
+
+// Buffers used in gpu kernels are also tracked by name on the device,
+// so we leave realizations that contain kernels alone.
+class ContainsGPULoop : public IRVisitor {
+public:
+    bool result;
+    ContainsGPULoop() : result(false) {}
+
+private:
+    using IRVisitor::visit;
+
+    void visit(const For *op) {
+        result = result || CodeGen_GPU_Dev::is_gpu_var(op->name);
+        IRVisitor::visit(op);
+    }
+};
+
+// Extern stages and debug_to_file refer to a buffer through a
+// Variable holding its address, usually via a buffer_t named
+// name.buffer. Neither ReuseStorage nor the last-use analysis that
+// places the dead marker sees those references, so buffers used that
+// way are not shared.
+class ReferencedByHandle : public IRVisitor {
+public:
+    bool result;
+    ReferencedByHandle(const string &b) : result(false), buffer(b) {}
+
+private:
+    using IRVisitor::visit;
+
+    string buffer;
+
+    void visit(const Variable *op) {
+        result = result || op->name == buffer || op->name == buffer + ".buffer";
+    }
+};
+
+bool referenced_by_handle(Stmt s, const string &buffer) {
+    ReferencedByHandle r(buffer);
+    s.accept(&r);
+    return r.result;
+}
+
+// Find the first allocation of the given type that happens after the
+// dead marker for a buffer, at the same loop level.
+class FindReusableAllocation : public IRVisitor {
+public:
+    string candidate;
+    // The size of the candidate, in terms of things defined outside
+    // the statement searched.
+    Expr size;
+
+    FindReusableAllocation(const string &b, Type t) : buffer(b), type(t), dead(false) {}
+
+private:
+    using IRVisitor::visit;
+
+    string buffer;
+    Type type;
+    bool dead;
+
+    // The lets enclosing the current statement, innermost last.
+    vector<pair<string, Expr> > lets;
+
+    void visit(const For *op) {
+        // Anything inside a loop happens many times per allocation of
+        // the buffer.
+    }
+
+    void visit(const LetStmt *op) {
+        lets.push_back(make_pair(op->name, op->value));
+        op->body.accept(this);
+        lets.pop_back();
+    }
+
+    void visit(const Free *op) {
+        dead = dead || (op->name == buffer);
+    }
+
+    void visit(const Allocate *op) {
+        if (!candidate.empty()) return;
+
+        if (dead && op->type == type) {
+            Expr s = op->size;
+            for (size_t i = lets.size(); i > 0; i--) {
+                s = substitute(lets[i-1].first, lets[i-1].second, s);
+            }
+            if (!reads_memory(s) && !referenced_by_handle(op->body, op->name)) {
+                candidate = op->name;
+                size = s;
+                return;
+            }
+        }
+
+        op->body.accept(this);
+    }
+
+    void visit(const Block *op) {
+        op->first.accept(this);
+        if (candidate.empty() && op->rest.defined()) {
+            op->rest.accept(this);
+        }
+    }
+};
+
+// Turn the dead marker for a buffer into a statement.
+class ReplaceDeadMarker : public IRMutator {
+public:
+    ReplaceDeadMarker(const string &b, Stmt r) : buffer(b), replacement(r) {}
+
+private:
+    using IRMutator::visit;
+
+    string buffer;
+    Stmt replacement;
+
+    void visit(const Free *op) {
+        if (op->name == buffer) {
+            stmt = replacement;
+        } else {
+            stmt = op;
+        }
+    }
+};
+
+// When allocation tracking is on, a buffer that reuses the storage of
+// another still reports its bytes under its own name, from where it
+// would have been allocated until its last use.
+Stmt track_reused_storage(const Allocate *op) {
+    Expr name = op->name;
+    Expr bytes = op->size * op->type.bytes();
+    Stmt begin = Evaluate::make(Call::make(Int(32), "halide_track_slice",
+                                           vec(name, bytes), Call::Extern));
+    Stmt end = Evaluate::make(Call::make(Int(32), "halide_track_slice_free",
+                                         vec(name, bytes), Call::Extern));
+
+    Stmt body = inject_free_marker(op->body, op->name);
+    if (body.same_as(op->body)) {
+        body = Block::make(body, end);
+    } else {
+        body = ReplaceDeadMarker(op->name, end).mutate(body);
+    }
+    return Block::make(begin, body);
+}
+
+// Make one buffer use the storage of another, and remove the dead
+// marker placed for the other buffer.
+class ReuseStorage : public IRMutator {
+public:
+    ReuseStorage(const string &f, const string &o) : from(f), onto(o) {}
+
+private:
+    using IRMutator::visit;
+
+    string from, onto;
+
+    void visit(const Allocate *op) {
+        if (op->name == from) {
+            if (allocation_tracking_enabled()) {
+                stmt = mutate(track_reused_storage(op));
+            } else {
+                stmt = mutate(op->body);
+            }
+        } else {
+            IRMutator::visit(op);
+        }
+    }
+
+    void visit(const Block *op) {
+        const Free *marker = op->rest.as<Free>();
+        if (marker && marker->name == onto) {
+            stmt = mutate(op->first);
+        } else {
+            IRMutator::visit(op);
+        }
+    }
+
+    void visit(const Load *op) {
+        IRMutator::visit(op);
+        if (op->name == from) {
+            op = expr.as<Load>();
+            expr = Load::make(op->type, onto, op->index, op->image, op->param);
+        }
+    }
+
+    void visit(const Store *op) {
+        IRMutator::visit(op);
+        if (op->name == from) {
+            op = stmt.as<Store>();
+            stmt = Store::make(onto, op->value, op->index);
+        }
+    }
+};
+
+class ShareStorage : public IRMutator {
+    using IRMutator::visit;
+
+    void visit(const Allocate *op) {
+        // Buffers further in may be able to share with each other first.
+        IRMutator::visit(op);
+        op = stmt.as<Allocate>();
+        assert(op);
+
+        ContainsGPULoop gpu;
+        op->body.accept(&gpu);
+        if (gpu.result) return;
+
+        if (referenced_by_handle(op->body, op->name)) return;
+
+        Stmt body = op->body;
+        Expr size = op->size;
+
+        while (true) {
+            Stmt marked = inject_free_marker(body, op->name);
+            if (marked.same_as(body)) break;
+
+            FindReusableAllocation find(op->name, op->type);
+            marked.accept(&find);
+            if (find.candidate.empty()) break;
+
+            debug(3) << "Buffer " << find.candidate << " can reuse the storage of " << op->name << "\n";
+
+            body = ReuseStorage(find.candidate, op->name).mutate(marked);
+
+            if (!is_one(simplify(find.size <= size))) {
+                size = max(size, find.size);
+            }
+        }
+
+        if (!body.same_as(op->body)) {
+            // It can only stay on the stack if it's still a constant size.
+            size = simplify(size);
+            stmt = Allocate::make(op->name, op->type, size, body,
+                                  op->on_stack && size.as<IntImm>() != NULL);
+        }
+    }
+};
+
+}
+
+Stmt share_storage(Stmt s) {
+    char *disable = getenv("HL_DISABLE_STORAGE_SHARING");
+    if (disable && atoi(disable) != 0) {
+        return s;
+    }
+    return ShareStorage().mutate(s);
+}
+
+}
+}
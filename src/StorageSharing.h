@@ -0,0 +1,28 @@
+#ifndef HALIDE_STORAGE_SHARING_H
+#define HALIDE_STORAGE_SHARING_H
+
+/** \file
+ * Defines the lowering pass that lets buffers reuse the memory of
+ * other buffers that are no longer needed.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Reuse the storage of dead buffers. If a buffer is allocated at the
+ * same loop level as another buffer of the same type, after the last
+ * use of that other buffer, then it can use the same memory instead of
+ * allocating its own. E.g. in a long chain of compute_root stages,
+ * each stage only needs the previous one, so two allocations are
+ * enough for the whole chain. The first allocation grows if need be to
+ * fit the second. Must be run after storage flattening. Does nothing
+ * if the environment variable HL_DISABLE_STORAGE_SHARING is set to a
+ * nonzero value. */
+Stmt share_storage(Stmt s);
+
+}
+}
+
+#endif
@@ -1,10 +1,13 @@
 #include <iostream>
 #include <string>
+#include <map>
+#include <sstream>
 
 #include "Target.h"
 #include "LLVM_Headers.h"
 #include "Debug.h"
 #include "Util.h"
+#include "Threads.h"
 
 namespace Halide {
 
@@ -303,21 +306,26 @@ llvm::Module *parse_bitcode_file(llvm::MemoryBuffer *bitcode_buffer, llvm::LLVMC
 #define DECLARE_LL_INITMOD(mod) \
     DECLARE_INITMOD(mod ## _ll)
 
+DECLARE_CPP_INITMOD(allocation_tracker)
+DECLARE_CPP_INITMOD(batch)
 DECLARE_CPP_INITMOD(android_clock)
 DECLARE_CPP_INITMOD(android_host_cpu_count)
 DECLARE_CPP_INITMOD(android_io)
 DECLARE_CPP_INITMOD(ios_io)
 DECLARE_CPP_INITMOD(cuda)
 DECLARE_CPP_INITMOD(cuda_debug)
+DECLARE_CPP_INITMOD(fake_mmap)
 DECLARE_CPP_INITMOD(fake_thread_pool)
 DECLARE_CPP_INITMOD(gcd_thread_pool)
 DECLARE_CPP_INITMOD(linux_clock)
 DECLARE_CPP_INITMOD(linux_host_cpu_count)
+DECLARE_CPP_INITMOD(linux_mmap)
 DECLARE_CPP_INITMOD(nogpu)
 DECLARE_CPP_INITMOD(opencl)
 DECLARE_CPP_INITMOD(opencl_debug)
 DECLARE_CPP_INITMOD(osx_host_cpu_count)
 DECLARE_CPP_INITMOD(osx_io)
+DECLARE_CPP_INITMOD(osx_mmap)
 DECLARE_CPP_INITMOD(posix_allocator)
 DECLARE_CPP_INITMOD(posix_clock)
 DECLARE_CPP_INITMOD(windows_clock)
@@ -378,11 +386,28 @@ void link_modules(std::vector<llvm::Module *> &modules) {
                        "halide_set_custom_do_par_for",
                        "halide_set_custom_do_task",
                        "halide_shutdown_thread_pool",
+                       "halide_set_shared_thread_pool",
+                       "halide_thread_pool_do_par_for",
+                       "halide_thread_pool_shutdown",
+                       "halide_set_num_threads",
+                       "halide_set_thread_pool_spin_count",
+                       "halide_set_concurrency_limit",
+                       "halide_set_thread_pool_affinity",
+                       "halide_enable_thread_pool_stats",
+                       "halide_get_thread_pool_stats",
+                       "halide_set_allocator_cache_limit",
+                       "halide_allocator_trim",
+                       "halide_get_allocator_stats",
+                       "halide_set_mmap_threshold",
+                       "halide_set_mmap_prefault",
+                       "halide_get_allocation_stats",
+                       "halide_get_allocation_high_water_mark",
                        "halide_shutdown_trace",
                        "halide_set_cuda_context",
                        "halide_set_cl_context",
                        "halide_dev_sync",
                        "halide_release",
+                       "halide_do_batch",
                        "halide_current_time_ns",
                        "halide_host_cpu_count",
                        ""};
@@ -419,11 +444,55 @@ void link_modules(std::vector<llvm::Module *> &modules) {
 
 }
 
+namespace {
+
+// Parsing and linking the runtime modules takes a good fraction of
+// the time to jit-compile a small pipeline. Each pipeline gets a
+// fresh llvm context, so we can't share modules between them, but we
+// can keep the linked module for each target as bitcode, which only
+// needs parsing once. Entries are never replaced or removed, so
+// references to them stay good after the lock is dropped.
+std::map<string, string> initial_module_bitcode;
+
+Internal::Mutex &initial_module_mutex() {
+    static Internal::Mutex *mutex = new Internal::Mutex;
+    return *mutex;
+}
+
+string initial_module_key(const Target &t) {
+    std::ostringstream key;
+    key << t.os << " " << t.arch << " " << t.bits << " " << t.features;
+    return key.str();
+}
+
+llvm::Module *parse_initial_module(const string &bitcode, llvm::LLVMContext *context) {
+    llvm::MemoryBuffer *bitcode_buffer = llvm::MemoryBuffer::getMemBuffer(bitcode);
+    llvm::Module *module = parse_bitcode_file(bitcode_buffer, context);
+    delete bitcode_buffer;
+    return module;
+}
+
+}
+
 namespace Internal {
 
 /** Create an llvm module containing the support code for a given target. */
 llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
 
+    string key = initial_module_key(t);
+    const string *cached = NULL;
+    {
+        ScopedLock lock(initial_module_mutex());
+        std::map<string, string>::iterator iter = initial_module_bitcode.find(key);
+        if (iter != initial_module_bitcode.end()) {
+            cached = &iter->second;
+        }
+    }
+    if (cached) {
+        debug(2) << "Parsing cached initial module for target " << key << "\n";
+        return parse_initial_module(*cached, c);
+    }
+
     assert(t.bits == 32 || t.bits == 64);
     // NaCl always uses the 32-bit runtime modules, because pointers
     // and size_t are 32-bit in 64-bit NaCl, and that's the only way
@@ -438,28 +507,34 @@ llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
         modules.push_back(get_initmod_posix_io(c, bits_64));
         modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_linux_mmap(c, bits_64));
     } else if (t.os == Target::OSX) {
         modules.push_back(get_initmod_osx_clock(c, bits_64));
         modules.push_back(get_initmod_osx_io(c, bits_64));
         modules.push_back(get_initmod_gcd_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_osx_mmap(c, bits_64));
     } else if (t.os == Target::Android) {
         modules.push_back(get_initmod_android_clock(c, bits_64));
         modules.push_back(get_initmod_android_io(c, bits_64));
         modules.push_back(get_initmod_android_host_cpu_count(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_linux_mmap(c, bits_64));
     } else if (t.os == Target::Windows) {
         modules.push_back(get_initmod_windows_clock(c, bits_64));
         modules.push_back(get_initmod_windows_io(c, bits_64));
         modules.push_back(get_initmod_fake_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_fake_mmap(c, bits_64));
     } else if (t.os == Target::IOS) {
         modules.push_back(get_initmod_posix_clock(c, bits_64));
         modules.push_back(get_initmod_ios_io(c, bits_64));
         modules.push_back(get_initmod_gcd_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_osx_mmap(c, bits_64));
     } else if (t.os == Target::NaCl) {
         modules.push_back(get_initmod_posix_clock(c, bits_64));
         modules.push_back(get_initmod_nacl_io(c, bits_64));
         modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_fake_mmap(c, bits_64));
     }
 
     // These modules are always used
@@ -468,6 +543,8 @@ llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
     modules.push_back(get_initmod_tracing(c, bits_64));
     modules.push_back(get_initmod_write_debug_image(c, bits_64));
     modules.push_back(get_initmod_posix_allocator(c, bits_64));
+    modules.push_back(get_initmod_allocation_tracker(c, bits_64));
+    modules.push_back(get_initmod_batch(c, bits_64));
     modules.push_back(get_initmod_posix_error_handler(c, bits_64));
 
     // These modules are optional
@@ -501,6 +578,17 @@ llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
 
     link_modules(modules);
 
+    // Save it for next time
+    string bitcode;
+    llvm::raw_string_ostream out(bitcode);
+    llvm::WriteBitcodeToFile(modules[0], out);
+    out.flush();
+    {
+        // If another thread got here first, keep its copy.
+        ScopedLock lock(initial_module_mutex());
+        initial_module_bitcode.insert(std::make_pair(key, bitcode));
+    }
+
     return modules[0];
 }
 
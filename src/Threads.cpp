@@ -0,0 +1,164 @@
+#include "Threads.h"
+#include "Util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace Halide {
+namespace Internal {
+
+#ifdef _WIN32
+
+// Critical sections are already recursive. We don't start threads on
+// windows, so events are always set by the time anyone waits.
+
+Mutex::Mutex() {
+    CRITICAL_SECTION *cs = new CRITICAL_SECTION;
+    InitializeCriticalSection(cs);
+    impl = cs;
+}
+
+Mutex::~Mutex() {
+    CRITICAL_SECTION *cs = (CRITICAL_SECTION *)impl;
+    DeleteCriticalSection(cs);
+    delete cs;
+}
+
+void Mutex::lock() {
+    EnterCriticalSection((CRITICAL_SECTION *)impl);
+}
+
+void Mutex::unlock() {
+    LeaveCriticalSection((CRITICAL_SECTION *)impl);
+}
+
+Event::Event() : impl(NULL), is_set(false) {}
+
+Event::~Event() {}
+
+void Event::set() {
+    is_set = true;
+}
+
+void Event::wait() {
+    assert(is_set && "Waiting for an event that will never happen");
+}
+
+bool Event::test() {
+    return is_set;
+}
+
+void run_in_background(void (*fn)(void *), void *arg) {
+    fn(arg);
+}
+
+#else
+
+Mutex::Mutex() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_t *m = new pthread_mutex_t;
+    pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    impl = m;
+}
+
+Mutex::~Mutex() {
+    pthread_mutex_t *m = (pthread_mutex_t *)impl;
+    pthread_mutex_destroy(m);
+    delete m;
+}
+
+void Mutex::lock() {
+    pthread_mutex_lock((pthread_mutex_t *)impl);
+}
+
+void Mutex::unlock() {
+    pthread_mutex_unlock((pthread_mutex_t *)impl);
+}
+
+namespace {
+struct EventImpl {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+}
+
+Event::Event() : is_set(false) {
+    EventImpl *e = new EventImpl;
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    impl = e;
+}
+
+Event::~Event() {
+    EventImpl *e = (EventImpl *)impl;
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->mutex);
+    delete e;
+}
+
+void Event::set() {
+    EventImpl *e = (EventImpl *)impl;
+    pthread_mutex_lock(&e->mutex);
+    is_set = true;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+void Event::wait() {
+    EventImpl *e = (EventImpl *)impl;
+    pthread_mutex_lock(&e->mutex);
+    while (!is_set) {
+        pthread_cond_wait(&e->cond, &e->mutex);
+    }
+    pthread_mutex_unlock(&e->mutex);
+}
+
+bool Event::test() {
+    EventImpl *e = (EventImpl *)impl;
+    pthread_mutex_lock(&e->mutex);
+    bool result = is_set;
+    pthread_mutex_unlock(&e->mutex);
+    return result;
+}
+
+namespace {
+struct ThreadStart {
+    void (*fn)(void *);
+    void *arg;
+};
+
+void *thread_main(void *p) {
+    ThreadStart start = *(ThreadStart *)p;
+    delete (ThreadStart *)p;
+    start.fn(start.arg);
+    return NULL;
+}
+}
+
+void run_in_background(void (*fn)(void *), void *arg) {
+    ThreadStart *start = new ThreadStart;
+    start->fn = fn;
+    start->arg = arg;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // Lowering and llvm both recurse deeply on big pipelines
+    pthread_attr_setstacksize(&attr, 64 * 1024 * 1024);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, thread_main, start);
+    pthread_attr_destroy(&attr);
+    assert(err == 0 && "Could not start a thread");
+    (void)err;
+}
+
+#endif
+
+}
+}
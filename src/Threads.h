@@ -0,0 +1,53 @@
+#ifndef HALIDE_THREADS_H
+#define HALIDE_THREADS_H
+
+/** \file
+ * Defines the few threading primitives the compiler itself uses. This
+ * is not part of the public interface.
+ */
+
+namespace Halide {
+namespace Internal {
+
+/** A recursive mutex. */
+class Mutex {
+    void *impl;
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+public:
+    Mutex();
+    ~Mutex();
+    void lock();
+    void unlock();
+};
+
+/** Holds a mutex for as long as it's in scope. */
+class ScopedLock {
+    Mutex &mutex;
+public:
+    ScopedLock(Mutex &m) : mutex(m) {mutex.lock();}
+    ~ScopedLock() {mutex.unlock();}
+};
+
+/** A flag that one thread sets and others can wait for. */
+class Event {
+    void *impl;
+    bool is_set;
+    Event(const Event &);
+    Event &operator=(const Event &);
+public:
+    Event();
+    ~Event();
+    void set();
+    void wait();
+    bool test();
+};
+
+/** Call a function on a new thread, which exits once it returns. On
+ * platforms without threads, calls it before returning. */
+void run_in_background(void (*fn)(void *), void *arg);
+
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "Util.h"
+#include "Threads.h"
 #include <sstream>
 #include <map>
 
@@ -10,9 +11,19 @@ using std::vector;
 using std::ostringstream;
 using std::map;
 
+namespace {
+// Funcs and Vars get named on the user's threads while pipelines
+// lower on others, so the counters below need a lock.
+Mutex &unique_name_mutex() {
+    static Mutex *mutex = new Mutex;
+    return *mutex;
+}
+}
+
 string unique_name(char prefix) {
     // arrays with static storage duration should be initialized to zero automatically
     static int instances[256];
+    ScopedLock lock(unique_name_mutex());
     ostringstream str;
     str << prefix << instances[(unsigned char)prefix]++;
     return str.str();
@@ -65,6 +76,7 @@ string unique_name(const string &name, bool user) {
         }
     }
 
+    ScopedLock lock(unique_name_mutex());
     int &count = known_names[name];
     count++;
     if (count == 1) {
@@ -316,7 +316,7 @@ class VectorizeLoops : public IRMutator {
             internal_allocations.push(op->name, 0);
             Stmt body = mutate(op->body);
             internal_allocations.pop(op->name);
-            stmt = Allocate::make(op->name, op->type, size * width, body);
+            stmt = Allocate::make(op->name, op->type, size * width, body, op->on_stack);
 
         }
 
@@ -72,6 +72,107 @@ extern int halide_do_par_for(void *user_context,
 extern void halide_shutdown_thread_pool();
 //@}
 
+/** Set the number of threads the default thread pool uses for
+ * parallel for loops, counting the thread that calls the
+ * pipeline. If the pool is running, it grows or shrinks in place when
+ * it can; otherwise it is shut down and restarts at the new size the
+ * next time it's used, so don't do that while parallel for loops are
+ * running. If this is never called, the environment variable
+ * HL_NUMTHREADS is used, if set, when the pool starts up. Otherwise
+ * the pool uses halide_host_cpu_count() threads, which on linux
+ * respects the cpu affinity mask and any cgroup cpu quota. Has no
+ * effect on platforms where %Halide does not own the thread pool.
+ *
+ * Jit-compiled pipelines all share one thread pool, so calling this
+ * or any of the other thread pool settings below from any of them
+ * configures that shared pool.
+ */
+extern void halide_set_num_threads(int n);
+
+/** Set how many times an idle thread in the default thread pool
+ * checks for new work, yielding the cpu between checks, before going
+ * to sleep. Higher values cut the latency of starting each parallel
+ * for loop at the cost of burning cpu time between them. Zero means
+ * idle threads sleep straight away. If this is never called, the
+ * environment variable HL_SPIN_COUNT is used, if set, when the pool
+ * starts up. Has no effect on platforms where %Halide does not own
+ * the thread pool.
+ */
+extern void halide_set_thread_pool_spin_count(int count);
+
+/** Cap the number of threads that may work at once on parallel for
+ * loops launched with the given user_context, including the thread
+ * that called the pipeline. Use this to stop one large request from
+ * occupying the whole thread pool while smaller ones wait. Zero or
+ * less removes the cap. Returns zero on success, or -1 if the cap
+ * can't be set, either because too many user_contexts have caps, or
+ * because the platform's thread pool doesn't support them.
+ */
+extern int halide_set_concurrency_limit(void *user_context, int threads);
+
+/** Pin each thread in the default thread pool to its own cpu, or
+ * stop doing so. Threads are placed one NUMA node at a time, prefer
+ * to steal work from threads on the same node, and parallel for
+ * loops launched from outside the pool are handed out to the nodes
+ * in contiguous blocks, so the same iterations land on the same node
+ * each time. Takes effect the next time the pool starts, i.e. before
+ * the first parallel for loop or after halide_shutdown_thread_pool.
+ * If this is never called, the environment variable
+ * HL_THREAD_AFFINITY is used, if set. Off by default.
+ */
+extern void halide_set_thread_pool_affinity(int pin);
+
+/** Statistics about one thread in the default thread pool. See
+ * halide_get_thread_pool_stats. Times are in nanoseconds. */
+struct halide_thread_pool_worker_stats {
+    /** Parallel for loop iterations run. */
+    uint64_t tasks;
+    /** Ranges of iterations taken from other threads. */
+    uint64_t ranges_stolen;
+    /** Time spent running iterations. */
+    uint64_t busy_ns;
+    /** Time spent waiting to acquire the pool's locks. */
+    uint64_t lock_wait_ns;
+    /** Time spent asleep waiting for work. */
+    uint64_t parked_ns;
+};
+
+/** Statistics about all the parallel for loops run by the default
+ * thread pool. A loop's imbalance is the time the threads available
+ * to it could have spent running its iterations but didn't, either
+ * because they were still waking up, or because they ran out of work
+ * before the slowest thread finished. Times are in nanoseconds. */
+struct halide_thread_pool_job_stats {
+    /** Parallel for loops run. */
+    uint64_t jobs;
+    /** Total time from launch to completion. */
+    uint64_t wall_ns;
+    /** Total time spent in their iterations, summed over threads. */
+    uint64_t busy_ns;
+    /** Total imbalance. */
+    uint64_t imbalance_ns;
+    /** The imbalance of the worst single loop. */
+    uint64_t max_imbalance_ns;
+};
+
+/** Gather statistics about what the default thread pool is doing. They
+ * start from zero each time the pool starts, so this must be called
+ * before the first parallel for loop, or followed by
+ * halide_shutdown_thread_pool. Alternatively, set the environment
+ * variable HL_THREAD_POOL_STATS=1. While gathering statistics, the
+ * pool prints them when it is shut down. When disabled (the default),
+ * nothing is measured. */
+extern void halide_enable_thread_pool_stats(int enable);
+
+/** Copy out the statistics gathered since the thread pool started. The
+ * statistics for up to max_workers threads are written to workers. The
+ * last of these covers all the threads outside the pool that launched
+ * parallel for loops. Returns the number of such entries available,
+ * or zero if statistics aren't being gathered. */
+extern int halide_get_thread_pool_stats(struct halide_thread_pool_job_stats *jobs,
+                                        struct halide_thread_pool_worker_stats *workers,
+                                        int max_workers);
+
 /** Define halide_malloc and halide_free to replace the default memory
  * allocator.  See Func::set_custom_allocator. (Specifically note that
  * halide_malloc must return a 32-byte aligned pointer, and it must be
@@ -83,6 +184,97 @@ extern void *halide_malloc(void *user_context, size_t x);
 extern void halide_free(void *user_context, void *ptr);
 //@}
 
+/** The default halide_malloc keeps blocks passed to halide_free in
+ * free lists binned by size class, and reuses them for later
+ * allocations of a similar size. This sets the most memory it will
+ * keep around in this way. The default is 256MB. Setting it to zero
+ * turns off the caching.
+ */
+extern void halide_set_allocator_cache_limit(size_t bytes);
+
+/** Return all memory held by the default halide_malloc's free lists
+ * to the system. */
+extern void halide_allocator_trim();
+
+/** Counters describing the default halide_malloc's behavior. */
+struct halide_allocator_stats {
+    /** The number of calls to halide_malloc. */
+    uint64_t mallocs;
+
+    /** How many of those had to go to the system allocator, because
+     * there was no suitable free block. */
+    uint64_t system_mallocs;
+
+    /** The number of blocks returned to the system allocator. */
+    uint64_t system_frees;
+
+    /** The number of bytes currently held in the free lists. */
+    uint64_t cached_bytes;
+
+    /** How many calls to halide_malloc were large enough to map
+     * memory directly from the OS. */
+    uint64_t mapped;
+};
+
+/** Get the counters for the default halide_malloc. */
+extern void halide_get_allocator_stats(struct halide_allocator_stats *stats);
+
+/** The default halide_malloc maps allocations of at least this many
+ * bytes directly from the OS (with mmap), instead of getting them
+ * from malloc, and unmaps them when they're freed. On Linux it asks
+ * for transparent huge pages for them, which cuts down on TLB misses
+ * and page faults for very large buffers. The default is 64MB, which
+ * is the largest size that is kept in the free lists. Allocations
+ * this big aren't kept in the free lists even if they'd otherwise
+ * fit. Pass (size_t)-1 to turn this off. If this isn't called, the
+ * threshold is read from the environment variable HL_MMAP_THRESHOLD
+ * the first time it's needed. */
+extern void halide_set_mmap_threshold(size_t bytes);
+
+/** Whether to fault in all the pages of mapped allocations as soon as
+ * they're made, rather than when the pipeline first touches them. Off
+ * by default, unless the environment variable HL_MMAP_PREFAULT is set
+ * to 1. */
+extern void halide_set_mmap_prefault(bool prefault);
+
+/** Heap allocation counters for one buffer (i.e. one Func), kept
+ * when a pipeline is compiled with the environment variable
+ * HL_TRACK_ALLOCATIONS set. */
+struct halide_allocation_stats {
+    /** The name of the buffer. */
+    const char *name;
+
+    /** The number of times it was allocated with halide_malloc. Buffers
+     * placed in a scratch arena, or in the storage of another buffer
+     * that's no longer needed, don't call halide_malloc, but their
+     * bytes are still counted below. */
+    uint64_t mallocs;
+
+    /** The total number of bytes allocated for it. */
+    uint64_t bytes;
+
+    /** The number of bytes allocated for it right now. */
+    uint64_t current_bytes;
+
+    /** The most bytes that were allocated for it at once. */
+    uint64_t peak_bytes;
+};
+
+/** Get the allocation counters for the last pipeline run that was
+ * compiled with HL_TRACK_ALLOCATIONS set. These pipelines also print
+ * the counters when they finish, in the same format as the
+ * profiler. The counters are reset each time such a pipeline starts,
+ * and are shared by pipelines running at the same time. Fills in up
+ * to max_buffers entries, and returns the number of buffers that were
+ * allocated.
+ */
+extern int halide_get_allocation_stats(struct halide_allocation_stats *stats, int max_buffers);
+
+/** Get the most bytes that were allocated at once, over all buffers,
+ * by the last pipeline run that was compiled with HL_TRACK_ALLOCATIONS
+ * set. */
+extern uint64_t halide_get_allocation_high_water_mark();
+
 /** Called when debug_to_file is used inside %Halide code.  See
  * Func::debug_to_file for how this is called
  *
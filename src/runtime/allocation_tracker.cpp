@@ -0,0 +1,158 @@
+#include "mini_stdint.h"
+
+#define WEAK __attribute__((weak))
+#ifndef NULL
+#define NULL 0
+#endif
+
+extern "C" {
+
+extern int halide_printf(void *user_context, const char *fmt, ...);
+extern int strcmp(const char *, const char *);
+extern void halide_spin_lock(volatile int *lock);
+extern void halide_spin_unlock(volatile int *lock);
+
+// When HL_TRACK_ALLOCATIONS is set at compile time, pipelines report
+// every heap allocation and free here, along with the name of the
+// buffer, and print what they did when they finish. Pipelines running
+// at the same time share the counters.
+
+#define MAX_TRACKED_BUFFERS 256
+
+struct halide_allocation_stats {
+    const char *name;
+    uint64_t mallocs;
+    uint64_t bytes;
+    uint64_t current_bytes;
+    uint64_t peak_bytes;
+};
+
+WEAK halide_allocation_stats halide_tracked_buffers[MAX_TRACKED_BUFFERS];
+WEAK int halide_num_tracked_buffers = 0;
+WEAK uint64_t halide_tracked_current_bytes = 0;
+WEAK uint64_t halide_tracked_peak_bytes = 0;
+WEAK volatile int halide_allocation_tracker_lock = 0;
+
+// Find the counters for a buffer, adding them if this is the first
+// time we've seen it. Returns NULL if there are too many buffers to
+// keep track of, in which case only the totals are kept. Call with
+// the lock held.
+WEAK halide_allocation_stats *halide_tracked_buffer(const char *name) {
+    for (int i = 0; i < halide_num_tracked_buffers; i++) {
+        halide_allocation_stats *b = halide_tracked_buffers + i;
+        if (b->name == name || strcmp(b->name, name) == 0) {
+            return b;
+        }
+    }
+    if (halide_num_tracked_buffers == MAX_TRACKED_BUFFERS) {
+        return NULL;
+    }
+    halide_allocation_stats *b = halide_tracked_buffers + halide_num_tracked_buffers++;
+    b->name = name;
+    b->mallocs = 0;
+    b->bytes = 0;
+    b->current_bytes = 0;
+    b->peak_bytes = 0;
+    return b;
+}
+
+WEAK int halide_allocation_tracking_begin(void *user_context, const char *pipeline) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    halide_num_tracked_buffers = 0;
+    halide_tracked_current_bytes = 0;
+    halide_tracked_peak_bytes = 0;
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+    return 0;
+}
+
+WEAK void halide_track_malloc(void *user_context, const char *name, size_t bytes) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    halide_allocation_stats *b = halide_tracked_buffer(name);
+    if (b) {
+        b->mallocs++;
+        b->bytes += bytes;
+        b->current_bytes += bytes;
+        if (b->current_bytes > b->peak_bytes) {
+            b->peak_bytes = b->current_bytes;
+        }
+    }
+    halide_tracked_current_bytes += bytes;
+    if (halide_tracked_current_bytes > halide_tracked_peak_bytes) {
+        halide_tracked_peak_bytes = halide_tracked_current_bytes;
+    }
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+}
+
+WEAK void halide_track_free(void *user_context, const char *name, size_t bytes) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    halide_allocation_stats *b = halide_tracked_buffer(name);
+    if (b) {
+        b->current_bytes -= bytes;
+    }
+    halide_tracked_current_bytes -= bytes;
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+}
+
+// Buffers that live in part of another allocation (a scratch arena,
+// or a buffer whose storage they reuse) report their bytes here, so
+// they're attributed to the right buffer. The memory itself was
+// already counted when the allocation it lives in was made, so this
+// doesn't count as a malloc, or towards the totals.
+WEAK int halide_track_slice(void *user_context, const char *name, int32_t bytes) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    halide_allocation_stats *b = halide_tracked_buffer(name);
+    if (b) {
+        b->bytes += bytes;
+        b->current_bytes += bytes;
+        if (b->current_bytes > b->peak_bytes) {
+            b->peak_bytes = b->current_bytes;
+        }
+    }
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+    return 0;
+}
+
+WEAK int halide_track_slice_free(void *user_context, const char *name, int32_t bytes) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    halide_allocation_stats *b = halide_tracked_buffer(name);
+    if (b) {
+        b->current_bytes -= bytes;
+    }
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+    return 0;
+}
+
+// Print the counters in the same form as the profiler does, one per
+// line.
+WEAK int halide_allocation_tracking_end(void *user_context, const char *pipeline) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    for (int i = 0; i < halide_num_tracked_buffers; i++) {
+        halide_allocation_stats *b = halide_tracked_buffers + i;
+        halide_printf(user_context, "halide_allocations mallocs %s %s %llu\n",
+                      pipeline, b->name, (unsigned long long)b->mallocs);
+        halide_printf(user_context, "halide_allocations bytes %s %s %llu\n",
+                      pipeline, b->name, (unsigned long long)b->bytes);
+        halide_printf(user_context, "halide_allocations peak %s %s %llu\n",
+                      pipeline, b->name, (unsigned long long)b->peak_bytes);
+    }
+    halide_printf(user_context, "halide_allocations peak %s total %llu\n",
+                  pipeline, (unsigned long long)halide_tracked_peak_bytes);
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+    return 0;
+}
+
+WEAK int halide_get_allocation_stats(halide_allocation_stats *stats, int max_buffers) {
+    halide_spin_lock(&halide_allocation_tracker_lock);
+    int n = halide_num_tracked_buffers;
+    for (int i = 0; i < n && i < max_buffers; i++) {
+        stats[i] = halide_tracked_buffers[i];
+    }
+    halide_spin_unlock(&halide_allocation_tracker_lock);
+    return n;
+}
+
+WEAK uint64_t halide_get_allocation_high_water_mark() {
+    return halide_tracked_peak_bytes;
+}
+
+}
@@ -0,0 +1,32 @@
+#include "mini_stdint.h"
+
+#define WEAK __attribute__((weak))
+
+extern "C" {
+
+extern int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                             int min, int size, uint8_t *closure);
+
+// Runs a jit-compiled pipeline over a batch of independent argument
+// lists (see Func::realize_batch), as the tasks of one parallel for
+// loop. Parallel loops inside the pipeline nest inside it.
+
+struct halide_batch_closure {
+    int (*wrapped_function)(const void **);
+    const void ***args;
+};
+
+WEAK int halide_batch_task(void *user_context, int idx, uint8_t *closure) {
+    halide_batch_closure *c = (halide_batch_closure *)closure;
+    return c->wrapped_function(c->args[idx]);
+}
+
+WEAK int halide_do_batch(void *user_context, int (*wrapped_function)(const void **),
+                         const void ***args, int size) {
+    halide_batch_closure c;
+    c.wrapped_function = wrapped_function;
+    c.args = args;
+    return halide_do_par_for(user_context, halide_batch_task, 0, size, (uint8_t *)&c);
+}
+
+}
@@ -0,0 +1,19 @@
+#include "mini_stdint.h"
+
+#define WEAK __attribute__((weak))
+#ifndef NULL
+#define NULL 0
+#endif
+
+extern "C" {
+
+// This platform doesn't support mapping memory directly, so large
+// allocations go through malloc like everything else.
+WEAK void *halide_map_memory(size_t bytes, bool prefault) {
+    return NULL;
+}
+
+WEAK void halide_unmap_memory(void *ptr, size_t bytes) {
+}
+
+}
@@ -7,6 +7,27 @@ extern "C" {
 WEAK void halide_shutdown_thread_pool() {
 }
 
+WEAK void halide_set_num_threads(int) {
+}
+
+WEAK void halide_set_thread_pool_spin_count(int) {
+}
+
+// Everything runs on the calling thread, so any limit is already met.
+WEAK int halide_set_concurrency_limit(void *, int) {
+    return 0;
+}
+
+WEAK void halide_set_thread_pool_affinity(int) {
+}
+
+WEAK void halide_enable_thread_pool_stats(int) {
+}
+
+WEAK int halide_get_thread_pool_stats(void *, void *, int) {
+    return 0;
+}
+
 WEAK int (*halide_custom_do_task)(void *, int (*)(void *, int, uint8_t *),
                                   int, uint8_t *);
 
@@ -16,6 +16,28 @@ extern void dispatch_apply_f(size_t iterations, dispatch_queue_t queue,
 WEAK void halide_shutdown_thread_pool() {
 }
 
+WEAK void halide_set_num_threads(int) {
+}
+
+WEAK void halide_set_thread_pool_spin_count(int) {
+}
+
+// Grand Central Dispatch owns the threads, so there's no way to cap
+// how many of them run our tasks.
+WEAK int halide_set_concurrency_limit(void *, int) {
+    return -1;
+}
+
+WEAK void halide_set_thread_pool_affinity(int) {
+}
+
+WEAK void halide_enable_thread_pool_stats(int) {
+}
+
+WEAK int halide_get_thread_pool_stats(void *, void *, int) {
+    return 0;
+}
+
 WEAK int (*halide_custom_do_task)(void *user_context, int (*)(void *, int, uint8_t *),
                                   int, uint8_t *);
 
@@ -3,9 +3,75 @@
 extern "C" {
 
 extern long sysconf(int);
+extern int atoi(const char *);
+extern void *fopen(const char *path, const char *mode);
+extern char *fgets(char *s, int size, void *f);
+extern int fclose(void *f);
+// Not available everywhere this module is used (e.g. NaCl).
+extern int sched_getaffinity(int pid, size_t size, void *mask) __attribute__((weak));
 
+// Read the first line of a small file. Returns false if it can't be read.
+WEAK bool halide_read_first_line(const char *path, char *buf, int size) {
+    void *f = fopen(path, "r");
+    if (!f) return false;
+    bool result = fgets(buf, size, f) != NULL;
+    fclose(f);
+    return result;
+}
+
+// The number of cpus worth of time the cgroup we're in is allowed to
+// use, rounded up, or zero if there's no quota.
+WEAK int halide_cgroup_cpu_quota() {
+    char buf[128];
+    long quota = -1, period = 0;
+    if (halide_read_first_line("/sys/fs/cgroup/cpu.max", buf, sizeof(buf))) {
+        // cgroup v2: "<quota> <period>", where quota may be "max".
+        if (buf[0] != 'm') {
+            quota = atoi(buf);
+            const char *c = buf;
+            while (*c && *c != ' ') c++;
+            period = atoi(c);
+        }
+    } else if (halide_read_first_line("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", buf, sizeof(buf))) {
+        // cgroup v1: the quota is -1 if there isn't one.
+        quota = atoi(buf);
+        if (halide_read_first_line("/sys/fs/cgroup/cpu/cpu.cfs_period_us", buf, sizeof(buf))) {
+            period = atoi(buf);
+        }
+    }
+    if (quota <= 0 || period <= 0) return 0;
+    return (int)((quota + period - 1) / period);
+}
+
+// The number of cpus in our affinity mask, or zero if we can't tell.
+WEAK int halide_affinity_cpu_count() {
+    if (!sched_getaffinity) return 0;
+    uint64_t mask[16];
+    if (sched_getaffinity(0, sizeof(mask), mask) != 0) return 0;
+    int count = 0;
+    for (int i = 0; i < 16; i++) {
+        for (uint64_t bits = mask[i]; bits; bits &= bits - 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// The number of cpus we can actually make use of. Inside a container,
+// this may be a lot fewer than the host has, either because we're
+// restricted to some of them, or because we have a cpu quota. Running
+// more threads than the quota allows just gets them throttled.
 WEAK int halide_host_cpu_count() {
-    return sysconf(84);
+    int count = sysconf(84);
+    int affinity = halide_affinity_cpu_count();
+    if (affinity > 0 && affinity < count) {
+        count = affinity;
+    }
+    int quota = halide_cgroup_cpu_quota();
+    if (quota > 0 && quota < count) {
+        count = quota;
+    }
+    return count < 1 ? 1 : count;
 }
 
 }
@@ -0,0 +1,50 @@
+#include "mini_stdint.h"
+
+#define WEAK __attribute__((weak))
+#ifndef NULL
+#define NULL 0
+#endif
+
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((void *)-1)
+#define MADV_HUGEPAGE 14
+
+extern "C" {
+
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern int munmap(void *addr, size_t length);
+extern int madvise(void *addr, size_t length, int advice);
+
+// Map fresh memory for a large allocation (see halide_malloc), backed
+// by transparent huge pages where the kernel allows it. Returns NULL
+// on failure.
+WEAK void *halide_map_memory(size_t bytes, bool prefault) {
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Fewer, larger pages means fewer TLB misses and fewer page
+    // faults. This fails harmlessly if huge pages are turned off.
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+
+    if (prefault) {
+        // Touch every page now, rather than faulting them in one at a
+        // time as the pipeline first writes to them. We have to do
+        // this after the madvise, so MAP_POPULATE is no good.
+        for (size_t i = 0; i < bytes; i += 4096) {
+            ((volatile char *)ptr)[i] = 0;
+        }
+    }
+
+    return ptr;
+}
+
+WEAK void halide_unmap_memory(void *ptr, size_t bytes) {
+    munmap(ptr, bytes);
+}
+
+}
@@ -0,0 +1,43 @@
+#include "mini_stdint.h"
+
+#define WEAK __attribute__((weak))
+#ifndef NULL
+#define NULL 0
+#endif
+
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x0002
+#define MAP_ANON 0x1000
+#define MAP_FAILED ((void *)-1)
+
+extern "C" {
+
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long long offset);
+extern int munmap(void *addr, size_t length);
+
+// Map fresh memory for a large allocation (see halide_malloc). There's
+// no transparent huge page support to ask for here. Returns NULL on
+// failure.
+WEAK void *halide_map_memory(size_t bytes, bool prefault) {
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (prefault) {
+        // Touch every page now, rather than faulting them in one at a
+        // time as the pipeline first writes to them.
+        for (size_t i = 0; i < bytes; i += 4096) {
+            ((volatile char *)ptr)[i] = 0;
+        }
+    }
+
+    return ptr;
+}
+
+WEAK void halide_unmap_memory(void *ptr, size_t bytes) {
+    munmap(ptr, bytes);
+}
+
+}
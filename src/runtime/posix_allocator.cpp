@@ -9,6 +9,14 @@ extern "C" {
 
 extern void *malloc(size_t);
 extern void free(void *);
+extern char *getenv(const char *);
+extern int atoi(const char *);
+extern unsigned long long strtoull(const char *, char **, int);
+
+// Provided by the platform-specific mmap module. Returns NULL if the
+// platform can't map memory directly.
+extern void *halide_map_memory(size_t bytes, bool prefault);
+extern void halide_unmap_memory(void *ptr, size_t bytes);
 
 WEAK void *(*halide_custom_malloc)(void *, size_t) = NULL;
 WEAK void (*halide_custom_free)(void *, void *) = NULL;
@@ -19,28 +27,346 @@ WEAK void halide_set_custom_allocator(void *(*cust_malloc)(void *, size_t),
     halide_custom_free = cust_free;
 }
 
+// Allocations that don't fit on the stack are typically made and
+// freed once per iteration of whatever loop they're computed at, often
+// inside a parallel for loop, and they're the same size every time. So
+// rather than handing freed blocks back to the system, we keep them
+// in free lists binned by size class and hand them out again.
+
+// Size classes are 64 bytes, and then four evenly-spaced steps per
+// power of two up to 64MB, so at most 25% of a block is wasted
+// rounding up. Anything larger goes straight to the system.
+#define MIN_CLASS_LOG2 6
+#define MAX_CLASS_LOG2 26
+#define NUM_SIZE_CLASSES (1 + 4 * (MAX_CLASS_LOG2 - MIN_CLASS_LOG2))
+#define UNPOOLED ((size_t)-1)
+#define MAPPED ((size_t)-2)
+
+// Freed blocks are spread over several shards, each with its own
+// lock, so that threads freeing and allocating at the same time mostly
+// don't contend. The runtime doesn't have thread-local storage it can
+// safely use (JIT modules come and go, and thread-local destructors
+// would outlive them), so a thread picks its shard from the address of
+// its stack instead. Each thread's stack is a separate region, so
+// concurrent threads tend to land on different shards.
+#define NUM_SHARDS 16
+
+struct halide_allocator_shard {
+    volatile int lock;
+    void *free_list[NUM_SIZE_CLASSES];
+    // Pad to a cache line, so that locking one shard doesn't slow
+    // down threads using the neighbouring ones.
+    char padding[64];
+};
+
+WEAK halide_allocator_shard halide_allocator_shards[NUM_SHARDS];
+
+// Stop caching freed blocks once this many bytes are sitting in the
+// free lists.
+WEAK size_t halide_allocator_cache_limit = 256 * 1024 * 1024;
+WEAK volatile size_t halide_allocator_cached_bytes = 0;
+
+// Allocations at least this big are mapped directly from the OS
+// rather than coming from malloc, so that they can use huge pages, and
+// so that their memory goes back to the OS as soon as they're freed.
+// By default this is where the size classes end. The environment
+// variables HL_MMAP_THRESHOLD and HL_MMAP_PREFAULT are read the first
+// time they're needed, unless they've been set explicitly.
+WEAK size_t halide_mmap_threshold = (size_t)1 << MAX_CLASS_LOG2;
+WEAK bool halide_mmap_prefault = false;
+WEAK bool halide_mmap_options_initialized = false;
+
+WEAK void halide_init_mmap_options() {
+    char *threshold = getenv("HL_MMAP_THRESHOLD");
+    if (threshold) {
+        halide_mmap_threshold = (size_t)strtoull(threshold, NULL, 10);
+    }
+    char *prefault = getenv("HL_MMAP_PREFAULT");
+    halide_mmap_prefault = prefault && atoi(prefault) != 0;
+    halide_mmap_options_initialized = true;
+}
+
+struct halide_allocator_stats {
+    uint64_t mallocs;
+    uint64_t system_mallocs;
+    uint64_t system_frees;
+    uint64_t cached_bytes;
+    uint64_t mapped;
+};
+
+WEAK volatile uint64_t halide_allocator_malloc_count = 0;
+WEAK volatile uint64_t halide_allocator_system_malloc_count = 0;
+WEAK volatile uint64_t halide_allocator_system_free_count = 0;
+WEAK volatile uint64_t halide_allocator_mapped_count = 0;
+
+WEAK int halide_size_class(size_t x) {
+    if (x <= ((size_t)1 << MIN_CLASS_LOG2)) return 0;
+    // x is in (2^k, 2^(k+1)]
+    int k = 63 - __builtin_clzll((uint64_t)(x - 1));
+    if (k >= MAX_CLASS_LOG2) return -1;
+    int step = (int)((x - 1 - ((size_t)1 << k)) >> (k - 2));
+    return 1 + 4 * (k - MIN_CLASS_LOG2) + step;
+}
+
+WEAK size_t halide_size_class_bytes(int c) {
+    if (c == 0) return (size_t)1 << MIN_CLASS_LOG2;
+    int k = MIN_CLASS_LOG2 + (c - 1) / 4;
+    return ((size_t)1 << k) + ((size_t)((c - 1) % 4 + 1) << (k - 2));
+}
+
+WEAK halide_allocator_shard *halide_my_allocator_shard() {
+    int on_stack;
+    size_t addr = (size_t)(&on_stack);
+    return halide_allocator_shards + ((addr >> 20) ^ (addr >> 24)) % NUM_SHARDS;
+}
+
+WEAK void halide_spin_lock(volatile int *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*lock) {}
+    }
+}
+
+WEAK void halide_spin_unlock(volatile int *lock) {
+    __sync_lock_release(lock);
+}
+
+WEAK void halide_lock_shard(halide_allocator_shard *s) {
+    halide_spin_lock(&s->lock);
+}
+
+WEAK void halide_unlock_shard(halide_allocator_shard *s) {
+    halide_spin_unlock(&s->lock);
+}
+
+WEAK void *halide_pop_free_block(halide_allocator_shard *s, int c) {
+    // Peek without the lock first, so that looking through shards with
+    // nothing to offer is cheap.
+    if (!s->free_list[c]) return NULL;
+    halide_lock_shard(s);
+    void *ptr = s->free_list[c];
+    if (ptr) {
+        s->free_list[c] = *(void **)ptr;
+    }
+    halide_unlock_shard(s);
+    return ptr;
+}
+
+WEAK void *halide_system_malloc(size_t x, size_t size_class) {
+    __sync_fetch_and_add(&halide_allocator_system_malloc_count, 1);
+    void *orig = malloc(x + 48);
+    if (orig == NULL) {
+        return NULL;
+    }
+    // Round up to next multiple of 32, leaving at least two words
+    // before it for the original pointer and the size class.
+    void *ptr = (void *)((((size_t)orig + 2 * sizeof(void *) + 31) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = size_class;
+    return ptr;
+}
+
+WEAK void halide_system_free(void *ptr) {
+    __sync_fetch_and_add(&halide_allocator_system_free_count, 1);
+    free(((void **)ptr)[-1]);
+}
+
+WEAK void *halide_mapped_malloc(size_t x) {
+    // The mapping is page-aligned, so we can leave a 32-byte aligned
+    // header at the start for the mapping size, the marker that says
+    // it's mapped, and the start of the mapping.
+    size_t bytes = x + 32;
+    void *orig = halide_map_memory(bytes, halide_mmap_prefault);
+    if (orig == NULL) {
+        return NULL;
+    }
+    __sync_fetch_and_add(&halide_allocator_mapped_count, 1);
+    void *ptr = (void *)((char *)orig + 32);
+    ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = MAPPED;
+    ((size_t *)ptr)[-3] = bytes;
+    return ptr;
+}
+
+WEAK void halide_mapped_free(void *ptr) {
+    halide_unmap_memory(((void **)ptr)[-1], ((size_t *)ptr)[-3]);
+}
+
 WEAK void *halide_malloc(void *user_context, size_t x) {
     if (halide_custom_malloc) {
         return halide_custom_malloc(user_context, x);
-    } else {
-        void *orig = malloc(x+40);
-        if (orig == NULL) {
-            // Will result in a failed assertion and a call to halide_error
-            return NULL;
+    }
+
+    __sync_fetch_and_add(&halide_allocator_malloc_count, 1);
+
+    if (!halide_mmap_options_initialized) {
+        halide_init_mmap_options();
+    }
+
+    if (x >= halide_mmap_threshold) {
+        void *ptr = halide_mapped_malloc(x);
+        if (ptr) {
+            return ptr;
         }
-        // Round up to next multiple of 32. Should add at least 8 bytes so we can fit the original pointer.
-        void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
-        ((void **)ptr)[-1] = orig;
+        // Fall back to malloc if the platform can't map memory.
+    }
+
+    int c = halide_size_class(x);
+    if (c < 0) {
+        return halide_system_malloc(x, UNPOOLED);
+    }
+
+    // Try our own shard first, then the others.
+    halide_allocator_shard *mine = halide_my_allocator_shard();
+    void *ptr = halide_pop_free_block(mine, c);
+    for (int i = 0; !ptr && i < NUM_SHARDS; i++) {
+        halide_allocator_shard *s = halide_allocator_shards + i;
+        if (s != mine) {
+            ptr = halide_pop_free_block(s, c);
+        }
+    }
+
+    if (ptr) {
+        __sync_fetch_and_sub(&halide_allocator_cached_bytes, halide_size_class_bytes(c));
         return ptr;
     }
+
+    // Will result in a failed assertion and a call to halide_error if this returns NULL
+    return halide_system_malloc(halide_size_class_bytes(c), (size_t)c);
 }
 
 WEAK void halide_free(void *user_context, void *ptr) {
     if (halide_custom_free) {
         halide_custom_free(user_context, ptr);
-    } else {
-        free(((void**)ptr)[-1]);
+        return;
+    }
+
+    size_t c = ((size_t *)ptr)[-2];
+    if (c == UNPOOLED) {
+        halide_system_free(ptr);
+        return;
+    } else if (c == MAPPED) {
+        halide_mapped_free(ptr);
+        return;
+    }
+
+    size_t bytes = halide_size_class_bytes((int)c);
+    size_t cached = __sync_add_and_fetch(&halide_allocator_cached_bytes, bytes);
+    if (cached > halide_allocator_cache_limit) {
+        __sync_fetch_and_sub(&halide_allocator_cached_bytes, bytes);
+        halide_system_free(ptr);
+        return;
+    }
+
+    halide_allocator_shard *s = halide_my_allocator_shard();
+    halide_lock_shard(s);
+    *(void **)ptr = s->free_list[c];
+    s->free_list[c] = ptr;
+    halide_unlock_shard(s);
+}
+
+WEAK void halide_allocator_trim() {
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        halide_allocator_shard *s = halide_allocator_shards + i;
+        for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+            halide_lock_shard(s);
+            void *ptr = s->free_list[c];
+            s->free_list[c] = NULL;
+            halide_unlock_shard(s);
+            while (ptr) {
+                void *next = *(void **)ptr;
+                __sync_fetch_and_sub(&halide_allocator_cached_bytes, halide_size_class_bytes(c));
+                halide_system_free(ptr);
+                ptr = next;
+            }
+        }
+    }
+}
+
+WEAK void halide_set_allocator_cache_limit(size_t bytes) {
+    halide_allocator_cache_limit = bytes;
+    if (halide_allocator_cached_bytes > bytes) {
+        halide_allocator_trim();
+    }
+}
+
+WEAK void halide_get_allocator_stats(halide_allocator_stats *stats) {
+    stats->mallocs = halide_allocator_malloc_count;
+    stats->system_mallocs = halide_allocator_system_malloc_count;
+    stats->system_frees = halide_allocator_system_free_count;
+    stats->cached_bytes = halide_allocator_cached_bytes;
+    stats->mapped = halide_allocator_mapped_count;
+}
+
+WEAK void halide_set_mmap_threshold(size_t bytes) {
+    if (!halide_mmap_options_initialized) {
+        halide_init_mmap_options();
+    }
+    halide_mmap_threshold = bytes;
+}
+
+WEAK void halide_set_mmap_prefault(bool prefault) {
+    if (!halide_mmap_options_initialized) {
+        halide_init_mmap_options();
+    }
+    halide_mmap_prefault = prefault;
+}
+
+// Allocations made inside the body of a parallel for loop are made
+// and freed once per task. When codegen can bound their size over the
+// whole loop, it instead makes a scratch pool before the loop starts
+// and has each task take a block from it, and give it back when done.
+// Blocks are never freed while the loop runs, so there are only ever
+// as many as there are tasks running at once, i.e. about one per
+// worker thread, and each worker keeps reusing the same memory.
+struct halide_scratch_pool {
+    volatile int lock;
+    size_t size;
+    void *free_list;
+};
+
+WEAK void *halide_scratch_pool_create(void *user_context, size_t size) {
+    halide_scratch_pool *pool =
+        (halide_scratch_pool *)halide_malloc(user_context, sizeof(halide_scratch_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->lock = 0;
+    pool->size = size;
+    pool->free_list = NULL;
+    return pool;
+}
+
+WEAK void *halide_scratch_acquire(void *user_context, void *p) {
+    halide_scratch_pool *pool = (halide_scratch_pool *)p;
+    halide_spin_lock(&pool->lock);
+    void *ptr = pool->free_list;
+    if (ptr) {
+        pool->free_list = *(void **)ptr;
+    }
+    halide_spin_unlock(&pool->lock);
+    if (ptr == NULL) {
+        ptr = halide_malloc(user_context, pool->size);
+    }
+    return ptr;
+}
+
+WEAK void halide_scratch_release(void *user_context, void *p, void *ptr) {
+    halide_scratch_pool *pool = (halide_scratch_pool *)p;
+    halide_spin_lock(&pool->lock);
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    halide_spin_unlock(&pool->lock);
+}
+
+WEAK void halide_scratch_pool_destroy(void *user_context, void *p) {
+    halide_scratch_pool *pool = (halide_scratch_pool *)p;
+    void *ptr = pool->free_list;
+    while (ptr) {
+        void *next = *(void **)ptr;
+        halide_free(user_context, ptr);
+        ptr = next;
     }
+    halide_free(user_context, pool);
 }
 
 }
@@ -28,6 +28,7 @@ typedef long pthread_mutexattr_t;
 extern int pthread_create(pthread_t *thread, pthread_attr_t const * attr,
                           void *(*start_routine)(void *), void * arg);
 extern int pthread_join(pthread_t thread, void **retval);
+extern pthread_t pthread_self();
 extern int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
 extern int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 extern int pthread_cond_broadcast(pthread_cond_t *cond);
@@ -36,43 +37,221 @@ extern int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t
 extern int pthread_mutex_lock(pthread_mutex_t *mutex);
 extern int pthread_mutex_unlock(pthread_mutex_t *mutex);
 extern int pthread_mutex_destroy(pthread_mutex_t *mutex);
+extern int sched_yield();
+// Not every posix platform has these, so check for them at runtime.
+extern int sched_setaffinity(int pid, size_t size, const void *mask) __attribute__((weak));
+extern int sched_getaffinity(int pid, size_t size, void *mask) __attribute__((weak));
+
+extern void *fopen(const char *path, const char *mode);
+extern char *fgets(char *s, int size, void *f);
+extern int fclose(void *f);
 
 extern char *getenv(const char *);
 extern int atoi(const char *);
+extern void *malloc(size_t);
+extern void free(void *);
 
 extern int halide_printf(void *user_context, const char *, ...);
+extern int64_t halide_current_time_ns(void *user_context);
 
 #ifndef NULL
 #define NULL 0
 #endif
 
+typedef int (*halide_task)(void *user_context, int, uint8_t *);
+typedef int (*halide_do_task_fn)(void *user_context, halide_task, int, uint8_t *);
+
+// A cap on the number of threads that may work on behalf of a single
+// user_context at once. No thread ever refuses work it has claimed;
+// instead, the task ranges of a limited user_context are only split
+// while fewer than limit of them exist, and each range is run by one
+// thread at a time.
+struct concurrency_limit {
+    void *user_context;
+    // Zero if this slot is free.
+    volatile int limit;
+    // The number of task ranges belonging to this user_context that
+    // are either queued or running.
+    volatile int ranges;
+};
+
+// One call to halide_do_par_for.
 struct work {
-    work *next_job;
+    // The halide_do_task of the module that launched this job. When
+    // several modules share one pool, each job must still respect the
+    // custom task handler of the module it came from.
+    halide_do_task_fn do_task;
+    // The concurrency limit for this job's user_context, if there is one.
+    concurrency_limit *limit;
     int (*f)(void *, int, uint8_t *);
     void *user_context;
-    int next, max;
     uint8_t *closure;
-    int active_workers;
+    // The number of tasks that have not yet finished. Only the thread
+    // that takes this to zero touches the job afterwards.
+    volatile int remaining;
     int exit_status;
-    bool running() { return next < max || active_workers > 0; }
+    // Time spent in this job's tasks, summed over threads. Only
+    // tracked while statistics are enabled.
+    uint64_t busy_ns;
+};
+
+// A contiguous range of tasks belonging to a single job. This is the
+// unit of work that moves between the deques.
+struct task_range {
+    work *job;
+    int min, max;
 };
 
+// Optional statistics about what the threads in the pool have been
+// doing, for diagnosing slow parallel loops. They're only gathered
+// while enabled; otherwise the only cost is a few predictable
+// branches per task range. These must match the definitions in
+// HalideRuntime.h.
+struct halide_thread_pool_worker_stats {
+    uint64_t tasks;
+    uint64_t ranges_stolen;
+    uint64_t busy_ns;
+    uint64_t lock_wait_ns;
+    uint64_t parked_ns;
+};
+
+struct halide_thread_pool_job_stats {
+    uint64_t jobs;
+    uint64_t wall_ns;
+    uint64_t busy_ns;
+    uint64_t imbalance_ns;
+    uint64_t max_imbalance_ns;
+};
+
+typedef halide_thread_pool_worker_stats worker_stats;
+
+// A thread pool living in some other module, to be used instead of
+// the one in this module. The JIT sets this so that all jit-compiled
+// pipelines in a process share a single pool. Configuring the pool
+// from any of those modules must then configure the shared one, so
+// this has an entry for each function that does so.
+struct halide_shared_thread_pool_functions {
+    int (*do_par_for)(void *, halide_do_task_fn, halide_task, int, int, uint8_t *);
+    void (*shutdown)();
+    void (*set_num_threads)(int);
+    void (*set_spin_count)(int);
+    int (*set_concurrency_limit)(void *, int);
+    void (*set_affinity)(int);
+    void (*enable_stats)(int);
+    int (*get_stats)(halide_thread_pool_job_stats *, halide_thread_pool_worker_stats *, int);
+};
+
+WEAK const halide_shared_thread_pool_functions *halide_shared_thread_pool = NULL;
+
+WEAK void halide_set_shared_thread_pool(const halide_shared_thread_pool_functions *pool) {
+    halide_shared_thread_pool = pool;
+}
+
+WEAK void halide_timed_lock(pthread_mutex_t *mutex, worker_stats *stats) {
+    if (stats) {
+        int64_t t = halide_current_time_ns(NULL);
+        pthread_mutex_lock(mutex);
+        stats->lock_wait_ns += halide_current_time_ns(NULL) - t;
+    } else {
+        pthread_mutex_lock(mutex);
+    }
+}
+
+// Each thread owns a deque of task ranges. The owner pushes and pops
+// at the bottom, and idle threads steal from the top. Each deque has
+// its own lock, so claiming work never contends on a lock shared by
+// the whole pool. It's a fixed-size ring buffer, allocated with the
+// rest of the pool when it starts, so that pushing and popping never
+// allocate or fail partway through a parallel loop. When it fills
+// up, ranges just stop being split.
+#define MAX_DEQUE_SIZE 256
+struct work_deque {
+    pthread_mutex_t mutex;
+    int top, bottom;
+    task_range ranges[MAX_DEQUE_SIZE];
+};
+
+WEAK bool halide_deque_push_bottom(work_deque *d, task_range r, worker_stats *stats) {
+    halide_timed_lock(&d->mutex, stats);
+    bool result = d->bottom - d->top < MAX_DEQUE_SIZE;
+    if (result) {
+        d->ranges[d->bottom % MAX_DEQUE_SIZE] = r;
+        d->bottom++;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return result;
+}
+
+WEAK bool halide_deque_pop_bottom(work_deque *d, task_range *r, worker_stats *stats) {
+    halide_timed_lock(&d->mutex, stats);
+    bool result = d->bottom > d->top;
+    if (result) {
+        d->bottom--;
+        *r = d->ranges[d->bottom % MAX_DEQUE_SIZE];
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return result;
+}
+
+// A racy check used to avoid taking locks on deques that are
+// obviously empty.
+WEAK bool halide_deque_empty(work_deque *d) {
+    volatile work_deque *vd = d;
+    return vd->bottom == vd->top;
+}
+
+WEAK bool halide_deque_steal_top(work_deque *d, task_range *r, worker_stats *stats) {
+    // Don't hammer the locks of empty deques while scanning for work.
+    if (halide_deque_empty(d)) {
+        return false;
+    }
+    halide_timed_lock(&d->mutex, stats);
+    bool result = d->bottom > d->top;
+    if (result) {
+        *r = d->ranges[d->top % MAX_DEQUE_SIZE];
+        d->top++;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return result;
+}
+
 // The work queue and thread pool is weak, so one big work queue is shared by all halide functions
-#define MAX_THREADS 64
 WEAK struct {
-    // all fields are protected by this mutex.
+    // Only used to put idle threads to sleep and to wake them
+    // up. Tasks are never claimed while holding this mutex.
     pthread_mutex_t mutex;
 
-    // Singly linked list for job stack
-    work *jobs;
-
-    // Broadcast whenever items are added to the queue or a job completes.
+    // Broadcast whenever work is added while threads are sleeping, or
+    // when a job completes.
     pthread_cond_t state_change;
-    // Keep track of threads so they can be joined at shutdown
-    pthread_t threads[MAX_THREADS];
+
+    // One deque per worker thread the pool has room for, plus one
+    // more at the end shared by all the threads outside the pool that
+    // call halide_do_par_for. Allocated when the pool starts up.
+    work_deque *deques;
+    int slots;
+
+    // Keep track of threads so they can be joined at shutdown. Workers
+    // are only created once they're needed.
+    pthread_t *threads;
+    int threads_created;
+
+    // Statistics for each deque's owner, if enabled. The last entry
+    // is shared by the threads outside the pool, and isn't updated
+    // atomically, so it's only approximate when several of them call
+    // halide_do_par_for at once.
+    worker_stats *stats;
+    halide_thread_pool_job_stats job_stats;
+
+    // The total number of task ranges sitting in deques. May briefly
+    // overestimate, but never underestimates.
+    volatile int queued;
+
+    // The number of threads waiting on state_change.
+    volatile int sleepers;
 
     // Global flag indicating
-    bool shutdown;
+    volatile bool shutdown;
 
     bool running() {
         return !shutdown;
@@ -80,10 +259,242 @@ WEAK struct {
 
 } halide_work_queue;
 
+// Workers may optionally be pinned to cpus. They're placed one node
+// at a time, so that neighbouring workers share a NUMA node and
+// prefer to steal from each other.
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+struct cpu_set {
+    uint64_t bits[MAX_CPUS / 64];
+
+    void clear() {
+        for (int i = 0; i < MAX_CPUS / 64; i++) bits[i] = 0;
+    }
+    void add(int cpu) {
+        bits[cpu / 64] |= ((uint64_t)1) << (cpu % 64);
+    }
+    bool contains(int cpu) const {
+        return (bits[cpu / 64] >> (cpu % 64)) & 1;
+    }
+};
+
+WEAK struct {
+    // Whether to pin workers to cpus. Unless it has been set
+    // explicitly, HL_THREAD_AFFINITY is consulted each time the pool
+    // starts up.
+    bool pin, pin_set;
+
+    // The number of NUMA nodes that workers were placed on. One if
+    // workers aren't pinned.
+    int nodes;
+
+    // For each deque, the cpu and node of the thread that owns it, or
+    // -1 for the deque shared by threads outside the pool.
+    int *cpu;
+    int *node;
+
+    // For each node, how many active workers it has, and one of them.
+    int node_workers[MAX_NODES];
+    int node_first_worker[MAX_NODES];
+} halide_thread_placement;
+
+WEAK void halide_set_thread_pool_affinity(int pin) {
+    if (halide_shared_thread_pool) {
+        (*halide_shared_thread_pool->set_affinity)(pin);
+        return;
+    }
+    halide_thread_placement.pin = pin != 0;
+    halide_thread_placement.pin_set = true;
+}
+
+#define MAX_CONCURRENCY_LIMITS 64
+WEAK struct {
+    // Held while adding or removing limits.
+    pthread_mutex_t mutex;
+    // The number of slots ever used, so that processes that never
+    // set a limit don't pay for looking them up.
+    volatile int count;
+    concurrency_limit limits[MAX_CONCURRENCY_LIMITS];
+} halide_concurrency_limits;
+
+// Limit the number of threads that work on parallel for loops
+// launched with the given user_context to at most the given number,
+// counting the calling thread. Zero or less removes the limit. Returns
+// zero on success, or -1 if too many distinct user_contexts have
+// limits. Nested parallel loops may briefly exceed the limit by one
+// range each, because a loop is never refused its first range.
+WEAK int halide_set_concurrency_limit(void *user_context, int threads) {
+    if (halide_shared_thread_pool) {
+        return (*halide_shared_thread_pool->set_concurrency_limit)(user_context, threads);
+    }
+    int result = 0;
+    pthread_mutex_lock(&halide_concurrency_limits.mutex);
+    concurrency_limit *existing = NULL, *free_slot = NULL;
+    for (int i = 0; i < halide_concurrency_limits.count; i++) {
+        concurrency_limit *l = halide_concurrency_limits.limits + i;
+        if (l->limit > 0 && l->user_context == user_context) {
+            existing = l;
+        } else if (l->limit <= 0 && l->ranges == 0 && free_slot == NULL) {
+            free_slot = l;
+        }
+    }
+    if (existing) {
+        existing->limit = threads > 0 ? threads : 0;
+    } else if (threads > 0) {
+        if (free_slot == NULL &&
+            halide_concurrency_limits.count < MAX_CONCURRENCY_LIMITS) {
+            free_slot = halide_concurrency_limits.limits + halide_concurrency_limits.count;
+            free_slot->ranges = 0;
+        }
+        if (free_slot) {
+            free_slot->user_context = user_context;
+            __sync_synchronize();
+            free_slot->limit = threads;
+            if (free_slot == halide_concurrency_limits.limits + halide_concurrency_limits.count) {
+                halide_concurrency_limits.count++;
+            }
+        } else {
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&halide_concurrency_limits.mutex);
+    return result;
+}
+
+WEAK concurrency_limit *halide_find_concurrency_limit(void *user_context) {
+    if (halide_concurrency_limits.count == 0) return NULL;
+    concurrency_limit *result = NULL;
+    pthread_mutex_lock(&halide_concurrency_limits.mutex);
+    for (int i = 0; i < halide_concurrency_limits.count; i++) {
+        concurrency_limit *l = halide_concurrency_limits.limits + i;
+        if (l->limit > 0 && l->user_context == user_context) {
+            result = l;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&halide_concurrency_limits.mutex);
+    return result;
+}
+
+// Reserve room for one more task range of the job. Fails if its
+// user_context is already at its concurrency limit.
+WEAK bool halide_reserve_range(work *job) {
+    concurrency_limit *l = job->limit;
+    if (l == NULL) return true;
+    int n = l->ranges;
+    while (n < l->limit) {
+        if (__sync_bool_compare_and_swap(&l->ranges, n, n + 1)) {
+            return true;
+        }
+        n = l->ranges;
+    }
+    return false;
+}
+
+WEAK void halide_release_range(work *job) {
+    if (job->limit) {
+        __sync_fetch_and_sub(&job->limit->ranges, 1);
+    }
+}
+
+// The number of threads working on parallel for loops, counting the
+// thread that called halide_do_par_for. Workers with an index of
+// halide_threads-1 or more are parked.
 WEAK int halide_threads;
 WEAK bool halide_thread_pool_initialized = false;
 
-WEAK void halide_shutdown_thread_pool() {
+// The number of threads asked for with halide_set_num_threads. Zero
+// if it hasn't been called, in which case HL_NUMTHREADS or the number
+// of cpus available is used each time the pool starts up.
+WEAK int halide_requested_threads = 0;
+
+// How many times an idle thread looks for new work, yielding the cpu
+// in between, before it goes to sleep. Spinning for a little while
+// means that back-to-back parallel for loops don't pay for waking
+// every thread up again. Unless it has been set explicitly,
+// HL_SPIN_COUNT is consulted each time the pool starts up.
+#define DEFAULT_SPIN_COUNT 256
+WEAK volatile int halide_spin_count = DEFAULT_SPIN_COUNT;
+WEAK bool halide_spin_count_set = false;
+
+WEAK void halide_set_thread_pool_spin_count(int count) {
+    if (halide_shared_thread_pool) {
+        (*halide_shared_thread_pool->set_spin_count)(count);
+        return;
+    }
+    halide_spin_count = count < 0 ? 0 : count;
+    halide_spin_count_set = true;
+}
+
+// Whether statistics are being gathered. Unless set explicitly,
+// HL_THREAD_POOL_STATS is consulted each time the pool starts up.
+WEAK bool halide_thread_pool_stats_enabled = false;
+WEAK bool halide_thread_pool_stats_set = false;
+
+WEAK void halide_enable_thread_pool_stats(int enable) {
+    if (halide_shared_thread_pool) {
+        (*halide_shared_thread_pool->enable_stats)(enable);
+        return;
+    }
+    halide_thread_pool_stats_enabled = enable != 0;
+    halide_thread_pool_stats_set = true;
+}
+
+// The statistics for the thread that owns the given deque, or NULL if
+// they aren't being gathered.
+WEAK worker_stats *halide_stats(int me) {
+    if (!halide_thread_pool_stats_enabled || !halide_work_queue.stats) {
+        return NULL;
+    }
+    return halide_work_queue.stats + me;
+}
+
+// Copy out the statistics gathered since the pool started. Returns the
+// number of deques, whose owners' statistics go in workers, up to
+// max_workers of them. The last deque is shared by all the threads
+// outside the pool.
+WEAK int halide_get_thread_pool_stats(halide_thread_pool_job_stats *jobs,
+                                      halide_thread_pool_worker_stats *workers,
+                                      int max_workers) {
+    if (halide_shared_thread_pool) {
+        return (*halide_shared_thread_pool->get_stats)(jobs, workers, max_workers);
+    }
+    pthread_mutex_lock(&halide_work_queue.mutex);
+    if (jobs) {
+        *jobs = halide_work_queue.job_stats;
+    }
+    int slots = halide_work_queue.stats ? halide_work_queue.slots : 0;
+    for (int i = 0; i < slots && i < max_workers; i++) {
+        workers[i] = halide_work_queue.stats[i];
+    }
+    pthread_mutex_unlock(&halide_work_queue.mutex);
+    return slots;
+}
+
+WEAK void halide_print_thread_pool_stats() {
+    halide_thread_pool_job_stats &j = halide_work_queue.job_stats;
+    halide_printf(NULL, "Thread pool: %lld parallel loops, %lld ms wall, %lld ms busy, "
+                  "%lld ms imbalance (worst %lld us)\n",
+                  (long long)j.jobs, (long long)(j.wall_ns / 1000000),
+                  (long long)(j.busy_ns / 1000000), (long long)(j.imbalance_ns / 1000000),
+                  (long long)(j.max_imbalance_ns / 1000));
+    halide_printf(NULL, " thread        tasks   steals  busy (ms)  lock (ms)  parked (ms)\n");
+    for (int i = 0; i < halide_work_queue.slots; i++) {
+        worker_stats &w = halide_work_queue.stats[i];
+        if (i < halide_work_queue.slots - 1) {
+            if (i >= halide_work_queue.threads_created) continue;
+            halide_printf(NULL, " %6d", i);
+        } else {
+            halide_printf(NULL, " caller");
+        }
+        halide_printf(NULL, " %12lld %8lld %10lld %10lld %12lld\n",
+                      (long long)w.tasks, (long long)w.ranges_stolen,
+                      (long long)(w.busy_ns / 1000000), (long long)(w.lock_wait_ns / 1000000),
+                      (long long)(w.parked_ns / 1000000));
+    }
+}
+
+WEAK void halide_thread_pool_shutdown() {
     if (!halide_thread_pool_initialized) return;
 
     // Wake everyone up and tell them the party's over and it's time
@@ -94,23 +505,48 @@ WEAK void halide_shutdown_thread_pool() {
     pthread_mutex_unlock(&halide_work_queue.mutex);
 
     // Wait until they leave
-    for (int i = 0; i < halide_threads-1; i++) {
+    for (int i = 0; i < halide_work_queue.threads_created; i++) {
         //fprintf(stderr, "Waiting for thread %d to exit\n", i);
         void *retval;
         pthread_join(halide_work_queue.threads[i], &retval);
     }
 
+    if (halide_work_queue.stats) {
+        halide_print_thread_pool_stats();
+    }
+
     //fprintf(stderr, "All threads have quit. Destroying mutex and condition variable.\n");
     // Tidy up
+    pthread_mutex_t uninitialized_mutex = {0};
     pthread_mutex_destroy(&halide_work_queue.mutex);
     // Reset it to zero in case we call another do_par_for
-    pthread_mutex_t uninitialized_mutex = {0};
     halide_work_queue.mutex = uninitialized_mutex;
+    for (int i = 0; i < halide_work_queue.slots; i++) {
+        pthread_mutex_destroy(&halide_work_queue.deques[i].mutex);
+    }
     pthread_cond_destroy(&halide_work_queue.state_change);
+    free(halide_work_queue.deques);
+    free(halide_work_queue.threads);
+    free(halide_work_queue.stats);
+    free(halide_thread_placement.cpu);
+    free(halide_thread_placement.node);
+    halide_work_queue.deques = NULL;
+    halide_work_queue.threads = NULL;
+    halide_work_queue.stats = NULL;
+    halide_thread_placement.cpu = NULL;
+    halide_thread_placement.node = NULL;
+    halide_work_queue.slots = 0;
+    halide_work_queue.threads_created = 0;
     halide_thread_pool_initialized = false;
 }
 
-typedef int (*halide_task)(void *user_context, int, uint8_t *);
+WEAK void halide_shutdown_thread_pool() {
+    if (halide_shared_thread_pool) {
+        (*halide_shared_thread_pool->shutdown)();
+    } else {
+        halide_thread_pool_shutdown();
+    }
+}
 
 WEAK int (*halide_custom_do_task)(void *user_context, halide_task, int, uint8_t *);
 
@@ -133,131 +569,590 @@ WEAK int halide_do_task(void *user_context, halide_task f, int idx,
     }
 }
 
-WEAK void *halide_worker_thread(void *void_arg) {
-    work *owned_job = (work *)void_arg;
+// Make some task ranges available to other threads, and wake up
+// anyone who is asleep.
+WEAK bool halide_enqueue_range(int me, task_range r, worker_stats *stats) {
+    // Count it before it becomes visible, so that queued never
+    // underestimates.
+    __sync_fetch_and_add(&halide_work_queue.queued, 1);
+    if (!halide_deque_push_bottom(halide_work_queue.deques + me, r, stats)) {
+        __sync_fetch_and_sub(&halide_work_queue.queued, 1);
+        return false;
+    }
+    if (halide_work_queue.sleepers > 0) {
+        pthread_mutex_lock(&halide_work_queue.mutex);
+        pthread_cond_broadcast(&halide_work_queue.state_change);
+        pthread_mutex_unlock(&halide_work_queue.mutex);
+    }
+    return true;
+}
 
-    // Grab the lock
-    pthread_mutex_lock(&halide_work_queue.mutex);
+// Read a list of cpus like "0-7,16-23", as found in sysfs.
+WEAK bool halide_read_cpu_list(const char *path, cpu_set *cpus) {
+    void *f = fopen(path, "r");
+    if (!f) return false;
+    char buf[1024];
+    bool result = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!result) return false;
 
-    // If I'm a job owner, then I was the thread that called
-    // do_par_for, and I should only stay in this function until my
-    // job is complete. If I'm a lowly worker thread, I should stay in
-    // this function as long as the work queue is running.
-    while (owned_job != NULL ? owned_job->running()
-           : halide_work_queue.running()) {
+    cpus->clear();
+    const char *c = buf;
+    while (*c >= '0' && *c <= '9') {
+        int first = 0, last;
+        while (*c >= '0' && *c <= '9') first = first * 10 + (*c++ - '0');
+        last = first;
+        if (*c == '-') {
+            c++;
+            last = 0;
+            while (*c >= '0' && *c <= '9') last = last * 10 + (*c++ - '0');
+        }
+        for (int i = first; i <= last && i < MAX_CPUS; i++) {
+            cpus->add(i);
+        }
+        if (*c == ',') c++;
+    }
+    return true;
+}
 
-        if (halide_work_queue.jobs == NULL) {
-            // There are no jobs pending, though some tasks may still
-            // be in flight from the last job. Release the lock and
-            // wait for something new to happen.
-            pthread_cond_wait(&halide_work_queue.state_change, &halide_work_queue.mutex);
-        } else {
-            // There are jobs still to do. Grab the next one.
-            work *job = halide_work_queue.jobs;
+extern int halide_host_cpu_count();
+
+// Decide which cpu each worker runs on. Workers are dealt out over
+// the cpus we're allowed to use, filling one node before moving on
+// to the next.
+WEAK void halide_place_workers() {
+    halide_thread_placement.nodes = 1;
+    for (int i = 0; i < halide_work_queue.slots; i++) {
+        halide_thread_placement.cpu[i] = -1;
+        halide_thread_placement.node[i] = -1;
+    }
+    if (!halide_thread_placement.pin || !sched_setaffinity) {
+        return;
+    }
+
+    cpu_set allowed;
+    allowed.clear();
+    if (!sched_getaffinity || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        allowed.clear();
+        for (int i = 0; i < halide_host_cpu_count() && i < MAX_CPUS; i++) {
+            allowed.add(i);
+        }
+    }
 
-            // Claim a task from it.
-            work myjob = *job;
-            job->next++;
+    // List the allowed cpus grouped by node.
+    static int order[MAX_CPUS], order_node[MAX_CPUS];
+    cpu_set listed;
+    listed.clear();
+    int count = 0, nodes = 0;
+    char path[64] = "/sys/devices/system/node/node";
+    int prefix = 0;
+    while (path[prefix]) prefix++;
+    for (int n = 0; n < MAX_NODES; n++) {
+        char *p = path + prefix;
+        if (n >= 10) *p++ = '0' + n / 10;
+        *p++ = '0' + n % 10;
+        const char *suffix = "/cpulist";
+        while ((*p++ = *suffix++));
 
-            // If there were no more tasks pending for this job, or if
-            // it has failed, remove it from the stack.
-            if (job->next == job->max) {
-                halide_work_queue.jobs = job->next_job;
+        cpu_set node_cpus;
+        if (!halide_read_cpu_list(path, &node_cpus)) continue;
+        int before = count;
+        for (int c = 0; c < MAX_CPUS; c++) {
+            if (node_cpus.contains(c) && allowed.contains(c) && !listed.contains(c)) {
+                listed.add(c);
+                order[count] = c;
+                order_node[count] = nodes;
+                count++;
             }
+        }
+        if (count > before) nodes++;
+    }
+    // Anything sysfs didn't tell us about goes on a node of its own.
+    int before = count;
+    for (int c = 0; c < MAX_CPUS; c++) {
+        if (allowed.contains(c) && !listed.contains(c)) {
+            order[count] = c;
+            order_node[count] = nodes;
+            count++;
+        }
+    }
+    if (count > before) nodes++;
+    if (count == 0) return;
 
-            // Increment the active_worker count so that other threads
-            // are aware that this job is still in progress even
-            // though there are no outstanding tasks for it.
-            job->active_workers++;
+    // The workers are all but the last deque.
+    for (int i = 0; i < halide_work_queue.slots - 1; i++) {
+        halide_thread_placement.cpu[i] = order[i % count];
+        halide_thread_placement.node[i] = order_node[i % count];
+    }
+}
 
-            // Release the lock and do the task.
-            pthread_mutex_unlock(&halide_work_queue.mutex);
-            int result = halide_do_task(myjob.user_context, myjob.f, myjob.next,
-                                        myjob.closure);
-            pthread_mutex_lock(&halide_work_queue.mutex);
+// Count up the active workers on each node. If there are fewer
+// workers than cpus, only the first few nodes get any.
+WEAK void halide_count_workers_per_node() {
+    for (int n = 0; n < MAX_NODES; n++) {
+        halide_thread_placement.node_workers[n] = 0;
+    }
+    int nodes = 1;
+    for (int i = 0; i < halide_threads - 1; i++) {
+        int node = halide_thread_placement.node[i];
+        if (node < 0) continue;
+        if (halide_thread_placement.node_workers[node]++ == 0) {
+            halide_thread_placement.node_first_worker[node] = i;
+        }
+        if (node >= nodes) {
+            nodes = node + 1;
+        }
+    }
+    halide_thread_placement.nodes = nodes;
+}
+
+// Hand out a parallel for loop to the nodes in contiguous blocks,
+// sized by how many workers each node has, so that consecutive
+// iterations (e.g. neighbouring rows) get computed by the same node
+// every time the loop runs. If a block doesn't fit in the deques, stops
+// there, and sets leftover to the rest of the loop, which the caller
+// should run itself. Otherwise leftover is empty.
+WEAK void halide_distribute_over_nodes(task_range r, int workers, task_range *leftover,
+                                       worker_stats *stats) {
+    int done = 0;
+    int min = r.min, size = r.max - r.min;
+    leftover->job = r.job;
+    leftover->min = leftover->max = r.min;
+    for (int n = 0; n < halide_thread_placement.nodes; n++) {
+        done += halide_thread_placement.node_workers[n];
+        task_range block = {r.job, min, r.min + (int)(((int64_t)size * done) / workers)};
+        if (n == halide_thread_placement.nodes - 1) {
+            // Workers with no known node aren't counted above.
+            block.max = r.max;
+        }
+        if (block.max > block.min &&
+            !halide_enqueue_range(halide_thread_placement.node_first_worker[n], block, stats)) {
+            leftover->min = block.min;
+            leftover->max = r.max;
+            return;
+        }
+        min = block.max;
+    }
+}
 
-            // If this task failed, set the exit status on the job.
-            if (result) {
-                job->exit_status = result;
+// Claim a task range, either from my own deque or by stealing from
+// someone else's, and run it. If workers are spread over several
+// nodes, only steal from other nodes if far is true. Returns false if
+// there was nothing to do.
+WEAK bool halide_run_some_tasks(int me, bool far) {
+    worker_stats *stats = halide_stats(me);
+    task_range r;
+    bool found = halide_deque_pop_bottom(halide_work_queue.deques + me, &r, stats);
+    int my_node = halide_thread_placement.node[me];
+    bool everywhere = halide_thread_placement.nodes == 1 || my_node < 0;
+    // Steal from my own node first.
+    for (int pass = 0; !found && pass < (far && !everywhere ? 2 : 1); pass++) {
+        for (int i = 1; !found && i < halide_work_queue.slots; i++) {
+            int victim = (me + i) % halide_work_queue.slots;
+            if (!everywhere &&
+                (halide_thread_placement.node[victim] == my_node) != (pass == 0)) {
+                continue;
             }
+            found = halide_deque_steal_top(halide_work_queue.deques + victim, &r, stats);
+            if (found && stats) {
+                stats->ranges_stolen++;
+            }
+        }
+    }
+    if (!found) return false;
+    __sync_fetch_and_sub(&halide_work_queue.queued, 1);
+
+    // Claim a chunk of the range and give the rest back, in the style
+    // of guided scheduling: the chunk is the remaining work divided by
+    // the number of threads, so chunks start large and shrink as the
+    // job drains. Whoever gets the remainder, me or a thief, splits it
+    // the same way. A loop over n tasks therefore touches a deque lock
+    // O(threads * log(n / threads)) times rather than n times, while
+    // the small chunks at the end keep everyone busy until the job
+    // is done.
+    work *job = r.job;
+    int size = r.max - r.min;
+    int threads = halide_threads;
+    if (job->limit && job->limit->limit < threads) {
+        threads = job->limit->limit;
+    }
+    if (threads > 1 && size > 1) {
+        int chunk = (size + threads - 1) / threads;
+        task_range rest = {job, r.min + chunk, r.max};
+        if (chunk < size && halide_reserve_range(job)) {
+            if (halide_enqueue_range(me, rest, stats)) {
+                r.max = rest.min;
+            } else {
+                halide_release_range(job);
+            }
+        }
+    }
+
+    int64_t start_time = 0;
+    uint64_t nested_ns = 0;
+    if (stats) {
+        start_time = halide_current_time_ns(NULL);
+        nested_ns = stats->busy_ns + stats->parked_ns;
+    }
+    for (int i = r.min; i < r.max; i++) {
+        int result = job->do_task(job->user_context, job->f, i, job->closure);
+        // If this task failed, set the exit status on the job.
+        if (result) {
+            job->exit_status = result;
+        }
+    }
+    int completed = r.max - r.min;
+    if (stats) {
+        // The job gets the whole time its tasks took, but my own busy
+        // time excludes anything I already counted while running or
+        // waiting for parallel loops nested inside them.
+        uint64_t elapsed = halide_current_time_ns(NULL) - start_time;
+        nested_ns = stats->busy_ns + stats->parked_ns - nested_ns;
+        stats->tasks += completed;
+        stats->busy_ns += elapsed > nested_ns ? elapsed - nested_ns : 0;
+        __sync_fetch_and_add(&job->busy_ns, elapsed);
+    }
+    halide_release_range(job);
+
+    // If the job is done, wake up the owner, unless it's still
+    // spinning. The owner counts itself as a sleeper before checking
+    // remaining under the mutex, so the wakeup can't be lost.
+    if (__sync_sub_and_fetch(&job->remaining, completed) == 0 &&
+        halide_work_queue.sleepers > 0) {
+        halide_timed_lock(&halide_work_queue.mutex, stats);
+        pthread_cond_broadcast(&halide_work_queue.state_change);
+        pthread_mutex_unlock(&halide_work_queue.mutex);
+    }
+    return true;
+}
 
-            // We are no longer active on this job
-            job->active_workers--;
+// Spin for a while waiting for either some work to show up nearby,
+// or for the condition halide_work_until is waiting on. Returns true
+// if it did something or the condition was met, or false if it's
+// time to look further afield and then sleep.
+WEAK bool halide_spin_for_work(int me, work *owned_job) {
+    for (int i = 0; i < halide_spin_count; i++) {
+        if (owned_job != NULL ? owned_job->remaining <= 0
+            : (!halide_work_queue.running() || me >= halide_threads - 1)) {
+            return true;
+        }
+        if (halide_work_queue.queued > 0 && halide_run_some_tasks(me, false)) {
+            return true;
+        }
+        sched_yield();
+    }
+    return false;
+}
 
-            // If the job is done and I'm not the owner of it, wake up
-            // the owner.
-            if (!job->running() && job != owned_job) {
-                pthread_cond_broadcast(&halide_work_queue.state_change);
+// Run tasks until either the given job is complete, or (if there is
+// no job) the thread pool shuts down. When there is nothing nearby to
+// steal, spins for a while, then tries other nodes, then sleeps.
+WEAK void halide_work_until(int me, work *owned_job) {
+    while (owned_job != NULL ? owned_job->remaining > 0
+           : halide_work_queue.running()) {
+        if (owned_job == NULL && me >= halide_threads - 1) {
+            // The pool has shrunk since I was created. Park until it
+            // grows again. Whatever was left in my deque will get
+            // stolen.
+            worker_stats *stats = halide_stats(me);
+            int64_t start_time = stats ? halide_current_time_ns(NULL) : 0;
+            pthread_mutex_lock(&halide_work_queue.mutex);
+            while (me >= halide_threads - 1 && halide_work_queue.running()) {
+                pthread_cond_wait(&halide_work_queue.state_change, &halide_work_queue.mutex);
             }
+            pthread_mutex_unlock(&halide_work_queue.mutex);
+            if (stats) {
+                stats->parked_ns += halide_current_time_ns(NULL) - start_time;
+            }
+            continue;
+        }
+        if (!halide_run_some_tasks(me, false) &&
+            !halide_spin_for_work(me, owned_job) &&
+            !halide_run_some_tasks(me, true)) {
+            // There are no tasks pending, though some may still be in
+            // flight. Wait for something new to happen.
+            worker_stats *stats = halide_stats(me);
+            halide_timed_lock(&halide_work_queue.mutex, stats);
+            __sync_fetch_and_add(&halide_work_queue.sleepers, 1);
+            if (halide_work_queue.queued <= 0 &&
+                (owned_job != NULL ? owned_job->remaining > 0
+                 : halide_work_queue.running())) {
+                int64_t start_time = stats ? halide_current_time_ns(NULL) : 0;
+                pthread_cond_wait(&halide_work_queue.state_change, &halide_work_queue.mutex);
+                if (stats) {
+                    stats->parked_ns += halide_current_time_ns(NULL) - start_time;
+                }
+            }
+            __sync_fetch_and_sub(&halide_work_queue.sleepers, 1);
+            pthread_mutex_unlock(&halide_work_queue.mutex);
         }
     }
-    pthread_mutex_unlock(&halide_work_queue.mutex);
-    return NULL;
 }
 
-extern int halide_host_cpu_count();
+WEAK void *halide_worker_thread(void *void_arg) {
+    int me = (int)(size_t)void_arg;
+    int cpu = halide_thread_placement.cpu[me];
+    if (cpu >= 0) {
+        cpu_set mask;
+        mask.clear();
+        mask.add(cpu);
+        sched_setaffinity(0, sizeof(mask), &mask);
+    }
+    halide_work_until(me, NULL);
+    return NULL;
+}
 
-WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
-                           int min, int size, uint8_t *closure) {
-    if (halide_custom_do_par_for) {
-        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+// Which deque the calling thread should use. Threads in the pool get
+// their own, and everyone else shares the last one.
+WEAK int halide_worker_index() {
+    pthread_t self = pthread_self();
+    for (int i = 0; i < halide_work_queue.threads_created; i++) {
+        if (halide_work_queue.threads[i] == self) return i;
     }
+    return halide_work_queue.slots - 1;
+}
 
-    // Grab the lock. If it hasn't been initialized yet, then the
-    // field will be zero-initialized because it's a static
-    // global. pthreads helpfully interprets zero-valued mutex objects
-    // as uninitialized and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
-    pthread_mutex_lock(&halide_work_queue.mutex);
+// Make sure the first n-1 workers exist. Called with the mutex held.
+WEAK void halide_create_workers(int n) {
+    while (halide_work_queue.threads_created < n - 1) {
+        int i = halide_work_queue.threads_created++;
+        pthread_create(halide_work_queue.threads + i, NULL,
+                       halide_worker_thread, (void *)(size_t)i);
+    }
+}
 
-    if (!halide_thread_pool_initialized) {
-        halide_work_queue.shutdown = false;
-        pthread_cond_init(&halide_work_queue.state_change, NULL);
-        halide_work_queue.jobs = NULL;
+// Start up the thread pool. Called with the mutex held. Returns false
+// if we ran out of memory, in which case the caller should run its
+// tasks itself.
+WEAK bool halide_thread_pool_start() {
+    halide_work_queue.shutdown = false;
+    halide_work_queue.queued = 0;
+    halide_work_queue.sleepers = 0;
 
+    int threads = halide_requested_threads;
+    if (threads == 0) {
         char *threadStr = getenv("HL_NUMTHREADS");
         if (threadStr) {
-            halide_threads = atoi(threadStr);
+            threads = atoi(threadStr);
         } else {
-            halide_threads = halide_host_cpu_count();
-            // halide_printf(user_context, "HL_NUMTHREADS not defined. Defaulting to %d threads.\n", halide_threads);
+            threads = halide_host_cpu_count();
+            // halide_printf(user_context, "HL_NUMTHREADS not defined. Defaulting to %d threads.\n", threads);
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (!halide_spin_count_set) {
+        char *spinStr = getenv("HL_SPIN_COUNT");
+        halide_spin_count = spinStr ? atoi(spinStr) : DEFAULT_SPIN_COUNT;
+        if (halide_spin_count < 0) halide_spin_count = 0;
+    }
+    if (!halide_thread_placement.pin_set) {
+        char *pinStr = getenv("HL_THREAD_AFFINITY");
+        halide_thread_placement.pin = pinStr && atoi(pinStr) != 0;
+    }
+    if (!halide_thread_pool_stats_set) {
+        char *statsStr = getenv("HL_THREAD_POOL_STATS");
+        halide_thread_pool_stats_enabled = statsStr && atoi(statsStr) != 0;
+    }
+
+    // Leave room for the pool to grow to twice the number of cpus
+    // without restarting.
+    int workers = halide_host_cpu_count() * 2;
+    if (workers < threads - 1) workers = threads - 1;
+    int slots = workers + 1;
+    halide_work_queue.deques = (work_deque *)malloc(slots * sizeof(work_deque));
+    halide_work_queue.threads = (pthread_t *)malloc(slots * sizeof(pthread_t));
+    halide_thread_placement.cpu = (int *)malloc(slots * sizeof(int));
+    halide_thread_placement.node = (int *)malloc(slots * sizeof(int));
+    if (!halide_work_queue.deques || !halide_work_queue.threads ||
+        !halide_thread_placement.cpu || !halide_thread_placement.node) {
+        free(halide_work_queue.deques);
+        free(halide_work_queue.threads);
+        free(halide_thread_placement.cpu);
+        free(halide_thread_placement.node);
+        halide_work_queue.deques = NULL;
+        halide_work_queue.threads = NULL;
+        halide_thread_placement.cpu = NULL;
+        halide_thread_placement.node = NULL;
+        return false;
+    }
+
+    // Statistics start from zero each time the pool starts. They're
+    // only kept if they're enabled when it starts.
+    halide_thread_pool_job_stats no_jobs = {0, 0, 0, 0, 0};
+    halide_work_queue.job_stats = no_jobs;
+    if (halide_thread_pool_stats_enabled) {
+        halide_work_queue.stats = (worker_stats *)malloc(slots * sizeof(worker_stats));
+        for (int i = 0; halide_work_queue.stats && i < slots; i++) {
+            worker_stats empty = {0, 0, 0, 0, 0};
+            halide_work_queue.stats[i] = empty;
         }
-        if (halide_threads > MAX_THREADS) {
-            halide_threads = MAX_THREADS;
-        } else if (halide_threads < 1) {
-            halide_threads = 1;
+    }
+
+    pthread_cond_init(&halide_work_queue.state_change, NULL);
+    halide_work_queue.slots = slots;
+    halide_work_queue.threads_created = 0;
+    for (int i = 0; i < slots; i++) {
+        pthread_mutex_init(&halide_work_queue.deques[i].mutex, NULL);
+        halide_work_queue.deques[i].top = 0;
+        halide_work_queue.deques[i].bottom = 0;
+    }
+    halide_threads = threads;
+    halide_place_workers();
+    halide_count_workers_per_node();
+    halide_create_workers(threads);
+    return true;
+}
+
+// Change the number of threads working on parallel for loops. If the
+// pool is running and has room, workers are created or parked as
+// needed. If it doesn't have room, it gets shut down, and restarts
+// with the new number of threads the next time it's used.
+WEAK void halide_set_num_threads(int n) {
+    if (halide_shared_thread_pool) {
+        (*halide_shared_thread_pool->set_num_threads)(n);
+        return;
+    }
+    if (n < 1) n = 1;
+    pthread_mutex_lock(&halide_work_queue.mutex);
+    halide_requested_threads = n;
+    bool restart = false;
+    if (halide_thread_pool_initialized) {
+        if (n <= halide_work_queue.slots) {
+            halide_create_workers(n);
+            halide_threads = n;
+            halide_count_workers_per_node();
+            // Wake up any parked workers.
+            pthread_cond_broadcast(&halide_work_queue.state_change);
+        } else {
+            restart = true;
         }
-        for (int i = 0; i < halide_threads-1; i++) {
-            //fprintf(stderr, "Creating thread %d\n", i);
-            pthread_create(halide_work_queue.threads + i, NULL, halide_worker_thread, NULL);
+    }
+    pthread_mutex_unlock(&halide_work_queue.mutex);
+    if (restart) {
+        halide_thread_pool_shutdown();
+    }
+}
+
+// Run a parallel for loop on the thread pool in this module, calling
+// the given do_task for each index.
+WEAK int halide_thread_pool_do_par_for(void *user_context, halide_do_task_fn do_task,
+                                       int (*f)(void *, int, uint8_t *),
+                                       int min, int size, uint8_t *closure) {
+    if (size <= 0) return 0;
+
+    if (!halide_thread_pool_initialized) {
+        // Grab the lock. If it hasn't been initialized yet, then the
+        // field will be zero-initialized because it's a static
+        // global. pthreads helpfully interprets zero-valued mutex objects
+        // as uninitialized and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
+        pthread_mutex_lock(&halide_work_queue.mutex);
+
+        if (!halide_thread_pool_initialized && halide_thread_pool_start()) {
+            __sync_synchronize();
+            halide_thread_pool_initialized = true;
         }
+        pthread_mutex_unlock(&halide_work_queue.mutex);
 
-        halide_thread_pool_initialized = true;
+        if (!halide_thread_pool_initialized) {
+            // Out of memory. Do it all here.
+            int exit_status = 0;
+            for (int i = min; i < min + size; i++) {
+                int result = do_task(user_context, f, i, closure);
+                if (result) exit_status = result;
+            }
+            return exit_status;
+        }
     }
 
     // Make the job.
     work job;
+    job.do_task = do_task;   // Run each task through this.
+    job.limit = halide_find_concurrency_limit(user_context);
     job.f = f;               // The job should call this function. It takes an index and a closure.
     job.user_context = user_context;
-    job.next = min;          // Start at this index.
-    job.max  = min + size;   // Keep going until one less than this index.
     job.closure = closure;   // Use this closure.
+    job.remaining = size;    // None of the tasks have run yet.
     job.exit_status = 0;     // The job hasn't failed yet
-    job.active_workers = 0;  // Nobody is working on this yet
+    job.busy_ns = 0;
 
-    // Push the job onto the stack.
-    job.next_job = halide_work_queue.jobs;
-    halide_work_queue.jobs = &job;
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+    int me = halide_worker_index();
+    worker_stats *stats = halide_stats(me);
+    int64_t start_time = stats ? halide_current_time_ns(NULL) : 0;
 
-    // Wake up any idle worker threads.
-    pthread_cond_broadcast(&halide_work_queue.state_change);
+    // Put the whole range in my deque. It gets split up as it is
+    // claimed. If the deque is full (very deep nesting), just run the
+    // tasks inline.
+    task_range r = {&job, min, min + size};
+    // The first range is always admitted, even if the user_context
+    // is at its limit, so that the loop makes progress.
+    if (job.limit) {
+        __sync_fetch_and_add(&job.limit->ranges, 1);
+    }
+    if (halide_thread_placement.nodes > 1 && job.limit == NULL &&
+        me == halide_work_queue.slots - 1 && size >= halide_thread_placement.nodes) {
+        // Loops launched from outside the pool get spread over the
+        // nodes. Nested loops stay on the node that launched them.
+        halide_distribute_over_nodes(r, halide_threads - 1, &r, stats);
+    } else if (!halide_enqueue_range(me, r, stats)) {
+        halide_release_range(&job);
+    } else {
+        r.max = r.min;
+    }
+    if (r.max > r.min) {
+        // There was no room for some of the tasks. Do them here.
+        for (int i = r.min; i < r.max; i++) {
+            int result = do_task(user_context, f, i, closure);
+            if (result) job.exit_status = result;
+        }
+        __sync_fetch_and_sub(&job.remaining, r.max - r.min);
+    }
 
-    // Do some work myself.
-    halide_worker_thread((void *)(&job));
+    // Do some work myself. While waiting for other threads to finish
+    // my tasks, I'll help out with whatever else is pending, which
+    // keeps nested parallel loops making progress.
+    halide_work_until(me, &job);
+
+    if (stats) {
+        // Time that threads could have spent on this job, but
+        // didn't. Includes the time taken to wake them up.
+        uint64_t wall = halide_current_time_ns(NULL) - start_time;
+        int threads = halide_threads;
+        if (job.limit && job.limit->limit < threads) {
+            threads = job.limit->limit;
+        }
+        if (threads > size) {
+            threads = size;
+        }
+        uint64_t capacity = wall * threads;
+        uint64_t imbalance = capacity > job.busy_ns ? capacity - job.busy_ns : 0;
+        pthread_mutex_lock(&halide_work_queue.mutex);
+        halide_thread_pool_job_stats &j = halide_work_queue.job_stats;
+        j.jobs++;
+        j.wall_ns += wall;
+        j.busy_ns += job.busy_ns;
+        j.imbalance_ns += imbalance;
+        if (imbalance > j.max_imbalance_ns) {
+            j.max_imbalance_ns = imbalance;
+        }
+        pthread_mutex_unlock(&halide_work_queue.mutex);
+    }
 
     // Return zero if the job succeeded, otherwise return the exit
     // status of one of the failing jobs (whichever one failed last).
     return job.exit_status;
 }
 
+WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                           int min, int size, uint8_t *closure) {
+    if (halide_custom_do_par_for) {
+        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+    } else if (halide_shared_thread_pool) {
+        return (*halide_shared_thread_pool->do_par_for)(user_context, halide_do_task, f, min, size, closure);
+    } else {
+        return halide_thread_pool_do_par_for(user_context, halide_do_task, f, min, size, closure);
+    }
+}
+
 }
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <Halide.h>
+#include <map>
+#include <string>
+
+using namespace Halide;
+
+// Check that a pipeline compiled with HL_TRACK_ALLOCATIONS set reports
+// the heap allocations of each buffer when it finishes.
+
+struct BufferCounters {
+    unsigned long long mallocs, bytes;
+    BufferCounters() : mallocs(0), bytes(0) {}
+};
+
+// Run a pipeline, and collect the counters it prints for each buffer.
+Image<int> run(Func f, std::map<std::string, BufferCounters> &counters,
+               unsigned long long &peak) {
+    f.compile_jit();
+
+    // The counters get printed to stderr, so capture it while we run
+    // the pipeline.
+    FILE *log = tmpfile();
+    fflush(stderr);
+    int saved_stderr = dup(fileno(stderr));
+    dup2(fileno(log), fileno(stderr));
+
+    Image<int> im = f.realize(100, 100);
+
+    fflush(stderr);
+    dup2(saved_stderr, fileno(stderr));
+    close(saved_stderr);
+
+    peak = 0;
+    char line[1024];
+    rewind(log);
+    while (fgets(line, sizeof(line), log)) {
+        char metric[256], pipeline[256], buffer[256];
+        unsigned long long value;
+        if (sscanf(line, "halide_allocations %255s %255s %255s %llu",
+                   metric, pipeline, buffer, &value) != 4) continue;
+        if (f.name() != pipeline) continue;
+
+        if (strcmp(metric, "mallocs") == 0) {
+            counters[buffer].mallocs = value;
+        } else if (strcmp(metric, "bytes") == 0) {
+            counters[buffer].bytes = value;
+        } else if (strcmp(metric, "peak") == 0 && strcmp(buffer, "total") == 0) {
+            peak = value;
+        }
+    }
+    fclose(log);
+
+    return im;
+}
+
+int main(int argc, char **argv) {
+    setenv("HL_TRACK_ALLOCATIONS", "1", 1);
+
+    {
+        Var x, y;
+        Func producer("producer"), consumer("consumer");
+        producer(x, y) = x*y;
+        consumer(x, y) = producer(x, y) + producer(x+1, y);
+        producer.compute_root();
+
+        std::map<std::string, BufferCounters> counters;
+        unsigned long long peak;
+        Image<int> im = run(consumer, counters, peak);
+
+        for (int y = 0; y < 100; y++) {
+            for (int x = 0; x < 100; x++) {
+                if (im(x, y) != x*y + (x+1)*y) {
+                    printf("im(%d, %d) = %d\n", x, y, im(x, y));
+                    return -1;
+                }
+            }
+        }
+
+        // The producer is 101x100 ints
+        if (counters["producer"].mallocs != 1 ||
+            counters["producer"].bytes != 101*100*sizeof(int) ||
+            peak < 101*100*sizeof(int)) {
+            printf("Allocation counters missing or wrong (mallocs: %llu, bytes: %llu, peak: %llu)\n",
+                   counters["producer"].mallocs, counters["producer"].bytes, peak);
+            return -1;
+        }
+    }
+
+    {
+        // Several intermediates at the same level. Some of them get
+        // grouped into one scratch arena, and some reuse the storage
+        // of others that are no longer needed, but each one should
+        // still have its own bytes reported under its own name.
+        Var x, y;
+        Func a("a"), b("b"), c("c"), d("d"), out("out");
+        a(x, y) = x + y;
+        b(x, y) = a(x, y) * 2;
+        c(x, y) = b(x, y) + a(x, y);
+        d(x, y) = c(x, y) - 1;
+        out(x, y) = d(x, y) + c(x, y);
+        a.compute_root();
+        b.compute_root();
+        c.compute_root();
+        d.compute_root();
+
+        std::map<std::string, BufferCounters> counters;
+        unsigned long long peak;
+        Image<int> im = run(out, counters, peak);
+
+        for (int y = 0; y < 100; y++) {
+            for (int x = 0; x < 100; x++) {
+                int correct = 6*(x + y) - 1;
+                if (im(x, y) != correct) {
+                    printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+
+        const char *names[] = {"a", "b", "c", "d"};
+        for (int i = 0; i < 4; i++) {
+            if (counters[names[i]].bytes != 100*100*sizeof(int)) {
+                printf("%s reported %llu bytes instead of %llu\n",
+                       names[i], counters[names[i]].bytes,
+                       (unsigned long long)(100*100*sizeof(int)));
+                return -1;
+            }
+        }
+
+        // The buffers that share memory shouldn't count towards the
+        // total twice.
+        if (peak < 100*100*sizeof(int) || peak > 4*(100*100*sizeof(int) + 32)) {
+            printf("Peak allocation of %llu bytes is wrong\n", peak);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that a BoundCall sees new inputs, outputs, and Param values.
+
+int check(Image<int> im, Image<int> in, int k) {
+    for (int y = 0; y < im.height(); y++) {
+        for (int x = 0; x < im.width(); x++) {
+            int correct = in(x, y) * k + x;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    ImageParam input(Int(32), 2);
+    Param<int> k;
+    Var x, y;
+    Func f;
+    f(x, y) = input(x, y) * k + x;
+
+    Image<int> in1(32, 32), in2(32, 32);
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            in1(x, y) = x + y;
+            in2(x, y) = x * y;
+        }
+    }
+
+    input.set(in1);
+    k.set(3);
+    BoundCall call = f.bind();
+
+    Image<int> out1(32, 32), out2(32, 32);
+    if (call.realize(out1) != 0) {
+        printf("BoundCall failed\n");
+        return -1;
+    }
+    if (check(out1, in1, 3)) return -1;
+
+    // New inputs, outputs, and Param values take effect on the next
+    // call.
+    call.set_input(input, in2);
+    k.set(5);
+    call.realize(out2);
+    if (check(out2, in2, 5)) return -1;
+
+    // Outputs stay set between calls.
+    k.set(7);
+    call.run();
+    if (check(out2, in2, 7)) return -1;
+
+    // The ImageParam itself is unchanged, so the Func still uses in1.
+    Image<int> out3 = f.realize(32, 32);
+    if (check(out3, in1, 7)) return -1;
+
+    // Funcs with several outputs
+    Func g;
+    g(x, y) = Tuple(input(x, y) * k + x, input(x, y) - y);
+    BoundCall call2 = g.bind();
+    Image<int> a(16, 16), b(16, 16);
+    call2.set_input(input, in2);
+    call2.realize(Realization(a, b));
+    if (check(a, in2, 7)) return -1;
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            if (b(x, y) != in2(x, y) - y) {
+                printf("b(%d, %d) = %d instead of %d\n", x, y, b(x, y), in2(x, y) - y);
+                return -1;
+            }
+        }
+    }
+
+    // A call bound while the optimized code from a tiered compile is
+    // still being built switches to it once it's done.
+    Func h;
+    h(x, y) = input(x, y) * k + x;
+    AsyncTask optimized = h.compile_jit_tiered();
+    BoundCall call3 = h.bind();
+    Image<int> out4(32, 32);
+    call3.realize(out4);
+    if (check(out4, in1, 7)) return -1;
+    if (optimized.defined()) optimized.wait();
+    k.set(2);
+    call3.realize(out4);
+    if (check(out4, in1, 2)) return -1;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that pipelines compiled and realized on background threads
+// compute the same thing as ones compiled and realized in the
+// foreground.
+
+int check(Image<int> im, int k) {
+    for (int y = 0; y < im.height(); y++) {
+        for (int x = 0; x < im.width(); x++) {
+            int correct = x*y + (x+1)*y + k;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+Func make_pipeline(int k) {
+    Var x, y;
+    Func f, g;
+    g(x, y) = x*y;
+    f(x, y) = g(x, y) + g(x+1, y) + k;
+    g.compute_root();
+    f.parallel(y).vectorize(x, 4);
+    return f;
+}
+
+int main(int argc, char **argv) {
+    // Keep every pipeline distinct, so that nothing comes out of the
+    // cache of jit-compiled pipelines.
+    set_jit_module_cache_size(0);
+
+    // Start compiling one pipeline, and use a different one while we
+    // wait.
+    Func slow = make_pipeline(1);
+    AsyncTask compiling = slow.compile_jit_async();
+
+    Func fallback = make_pipeline(2);
+    if (check(fallback.realize(64, 64), 2)) return -1;
+
+    compiling.wait();
+    if (!compiling.finished()) {
+        printf("Compilation didn't finish\n");
+        return -1;
+    }
+    if (check(slow.realize(64, 64), 1)) return -1;
+
+    // Realizing without waiting should wait for the compilation.
+    Func other = make_pipeline(3);
+    other.compile_jit_async();
+    if (check(other.realize(64, 64), 3)) return -1;
+
+    // Start several realizations at once, each of which compiles its
+    // own pipeline.
+    const int n = 4;
+    Func funcs[n];
+    Image<int> outputs[n];
+    AsyncTask tasks[n];
+    for (int i = 0; i < n; i++) {
+        funcs[i] = make_pipeline(10 + i);
+        outputs[i] = Image<int>(64, 64);
+        tasks[i] = funcs[i].realize_async(outputs[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        tasks[i].wait();
+        if (check(outputs[i], 10 + i)) return -1;
+    }
+
+    // The Funcs keep what was compiled for them in the background.
+    for (int i = 0; i < n; i++) {
+        if (check(funcs[i].realize(32, 32), 10 + i)) return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
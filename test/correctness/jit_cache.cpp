@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that jit-compiled pipelines get saved to the cache directory,
+// and that a pipeline loaded from it computes the right thing.
+
+std::string cache_dir;
+
+int count_entries() {
+    int count = 0;
+    DIR *dir = opendir(cache_dir.c_str());
+    while (dirent *e = readdir(dir)) {
+        if (e->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Saving an entry renames a new file into place, so the inode
+// changes whenever an entry is written.
+ino_t entry_inode() {
+    ino_t inode = 0;
+    DIR *dir = opendir(cache_dir.c_str());
+    while (dirent *e = readdir(dir)) {
+        struct stat st;
+        if (e->d_name[0] != '.' &&
+            stat((cache_dir + "/" + e->d_name).c_str(), &st) == 0) {
+            inode = st.st_ino;
+        }
+    }
+    closedir(dir);
+    return inode;
+}
+
+void remove_entries() {
+    DIR *dir = opendir(cache_dir.c_str());
+    while (dirent *e = readdir(dir)) {
+        if (e->d_name[0] != '.') {
+            remove((cache_dir + "/" + e->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(cache_dir.c_str());
+}
+
+int check(Func f, int offset) {
+    Image<int> im = f.realize(64, 64);
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            int correct = x*y + (x+1)*y + offset;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    #ifdef __APPLE__
+    // The cache needs MCJIT, which isn't used on os x yet.
+    printf("Success!\n");
+    return 0;
+    #endif
+
+    char dir_template[] = "/tmp/halide_jit_cache_XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        printf("Could not make a directory for the cache\n");
+        return -1;
+    }
+    cache_dir = dir_template;
+    set_jit_cache_directory(cache_dir);
+
+    Var x, y;
+    Func f, g;
+    g(x, y) = x*y;
+    f(x, y) = g(x, y) + g(x+1, y);
+    g.compute_root();
+
+    // Compiling the first time should add an entry.
+    f.compile_jit();
+    if (count_entries() != 1) {
+        printf("%d entries in the cache after compiling once\n", count_entries());
+        remove_entries();
+        return -1;
+    }
+    if (check(f, 0)) {
+        remove_entries();
+        return -1;
+    }
+
+    // Compiling the same pipeline again should load it from the
+    // cache directory rather than compile it and save it again. Turn
+    // off the in-process module cache so that it doesn't hand back
+    // the code compiled above.
+    set_jit_module_cache_size(0);
+    ino_t saved = entry_inode();
+    f.compile_jit();
+    if (count_entries() != 1) {
+        printf("%d entries in the cache after compiling the same thing again\n", count_entries());
+        remove_entries();
+        return -1;
+    }
+    if (entry_inode() != saved) {
+        printf("The pipeline was compiled and saved again instead of loaded from the cache\n");
+        remove_entries();
+        return -1;
+    }
+    if (check(f, 0)) {
+        remove_entries();
+        return -1;
+    }
+
+    // A different pipeline gets its own entry.
+    Func h;
+    h(x, y) = f(x, y) + 3;
+    h.compile_jit();
+    if (count_entries() != 2) {
+        printf("%d entries in the cache after compiling a second pipeline\n", count_entries());
+        remove_entries();
+        return -1;
+    }
+    if (check(h, 3)) {
+        remove_entries();
+        return -1;
+    }
+
+    remove_entries();
+
+    printf("Success!\n");
+    return 0;
+}
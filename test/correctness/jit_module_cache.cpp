@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <math.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that pipelines which differ only in the names of things share
+// machine code, and still compute their own results.
+
+Func make_pipeline(Param<int> p) {
+    Var x, y;
+    Func f, g;
+    f(x, y) = x*y + p;
+    g(x, y) = f(x, y) + f(x+1, y);
+    f.compute_root();
+    return g;
+}
+
+int check(Image<int> im, int p) {
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            int correct = x*y + (x+1)*y + 2*p;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void my_error_handler(void *user_context, const char *msg) {
+    printf("Unexpected error: %s\n", msg);
+}
+
+int main(int argc, char **argv) {
+    set_jit_module_cache_size(32);
+
+    Param<int> p1, p2;
+    p1.set(3);
+    p2.set(5);
+
+    JITModuleCacheStats before = get_jit_module_cache_stats();
+    if (check(make_pipeline(p1).realize(32, 32), 3)) return -1;
+    if (check(make_pipeline(p2).realize(32, 32), 5)) return -1;
+    JITModuleCacheStats after = get_jit_module_cache_stats();
+
+    if (after.misses - before.misses != 1 || after.hits - before.hits != 1) {
+        printf("Compiling the same pipeline twice had %d misses and %d hits\n",
+               after.misses - before.misses, after.hits - before.hits);
+        return -1;
+    }
+
+    // A pipeline that does something different must not reuse it.
+    {
+        Var x, y;
+        Func f;
+        f(x, y) = x*y + p1;
+        Image<int> im = f.realize(32, 32);
+        if (im(3, 4) != 15) {
+            printf("im(3, 4) = %d instead of 15\n", im(3, 4));
+            return -1;
+        }
+    }
+    JITModuleCacheStats different = get_jit_module_cache_stats();
+    if (different.hits != after.hits) {
+        printf("A different pipeline reused the machine code of another\n");
+        return -1;
+    }
+
+    // Shrinking the cache to one pipeline drops the least recently
+    // used one, which is the first.
+    set_jit_module_cache_size(1);
+    if (check(make_pipeline(p1).realize(32, 32), 3)) return -1;
+    JITModuleCacheStats evicted = get_jit_module_cache_stats();
+    if (evicted.misses != different.misses + 1 ||
+        evicted.hits != different.hits ||
+        evicted.evictions <= different.evictions ||
+        evicted.entries != 1) {
+        printf("Expected a miss after the pipeline was evicted\n");
+        return -1;
+    }
+
+    // Pipelines whose float constants differ only in the last bit
+    // must not share machine code.
+    float a = 1.0f, b = nextafterf(1.0f, 2.0f);
+    Image<float> ima, imb;
+    {
+        Var x;
+        Func f;
+        f(x) = cast<float>(x) * a;
+        ima = f.realize(16);
+    }
+    JITModuleCacheStats before_b = get_jit_module_cache_stats();
+    {
+        Var x;
+        Func f;
+        f(x) = cast<float>(x) * b;
+        imb = f.realize(16);
+    }
+    JITModuleCacheStats after_b = get_jit_module_cache_stats();
+    if (after_b.hits != before_b.hits) {
+        printf("Pipelines with different float constants shared machine code\n");
+        return -1;
+    }
+    for (int x = 0; x < 16; x++) {
+        if (ima(x) != x * a || imb(x) != x * b) {
+            printf("At %d: %.9g and %.9g instead of %.9g and %.9g\n",
+                   x, ima(x), imb(x), x * a, x * b);
+            return -1;
+        }
+    }
+
+    // Handlers are part of the state of the compiled pipeline, so
+    // Funcs with handlers of their own don't share machine code, even
+    // if they set them after getting it from the cache.
+    set_jit_module_cache_size(32);
+    Func shared = make_pipeline(p1);
+    if (check(shared.realize(32, 32), 3)) return -1;
+    JITModuleCacheStats before_handlers = get_jit_module_cache_stats();
+
+    Func with_handler = make_pipeline(p1);
+    with_handler.set_error_handler(&my_error_handler);
+    if (check(with_handler.realize(32, 32), 3)) return -1;
+
+    Func later_handler = make_pipeline(p1);
+    if (check(later_handler.realize(32, 32), 3)) return -1;
+    JITModuleCacheStats after_sharing = get_jit_module_cache_stats();
+    later_handler.set_error_handler(&my_error_handler);
+    if (check(later_handler.realize(32, 32), 3)) return -1;
+    if (check(shared.realize(32, 32), 3)) return -1;
+
+    JITModuleCacheStats after_handlers = get_jit_module_cache_stats();
+    if (after_sharing.hits != before_handlers.hits + 1 ||
+        after_handlers.hits != after_sharing.hits ||
+        after_handlers.misses != before_handlers.misses) {
+        printf("A Func with a custom error handler shared machine code\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
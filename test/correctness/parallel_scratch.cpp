@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that an intermediate computed per row of a parallel loop
+// reuses the same few blocks of memory, rather than being allocated
+// and freed once per row.
+
+int malloc_count = 0;
+int free_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    __sync_fetch_and_add(&malloc_count, 1);
+    void *orig = malloc(x+32);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    __sync_fetch_and_add(&free_count, 1);
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    const int W = 4096, H = 1000;
+
+    Var x, y;
+    Func f, g;
+
+    // Too big for the stack
+    g(x, y) = x*y;
+    f(x, y) = g(x-1, y) + g(x+1, y);
+
+    g.compute_at(f, y);
+    f.parallel(y);
+
+    f.set_custom_allocator(my_malloc, my_free);
+
+    Image<int> im = f.realize(W, H);
+
+    // One block per task running at once, plus the pool itself.
+    if (malloc_count >= H) {
+        printf("%d calls to malloc for %d rows\n", malloc_count, H);
+        return -1;
+    }
+
+    if (malloc_count != free_count) {
+        printf("%d calls to malloc and %d calls to free\n", malloc_count, free_count);
+        return -1;
+    }
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            if (im(x, y) != (x-1)*y + (x+1)*y) {
+                printf("im(%d, %d) = %d\n", x, y, im(x, y));
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that versions of a pipeline specialized to Param values give
+// the same results as the generic code, that realize falls back to
+// the generic code once there are too many of them, and that values
+// outside a Param's range are still reported.
+
+bool error_occurred = false;
+void my_error_handler(void *user_context, const char *msg) {
+    printf("Expected: %s\n", msg);
+    error_occurred = true;
+}
+
+// Each version gets compiled through the jit module cache, so the
+// number of lookups in it is the number of versions compiled.
+int compiles() {
+    JITModuleCacheStats stats = get_jit_module_cache_stats();
+    return stats.hits + stats.misses;
+}
+
+int main(int argc, char **argv) {
+    set_jit_module_cache_size(32);
+
+    ImageParam input(Int(32), 1);
+    Param<int> radius;
+    Param<float> weight;
+    Param<bool> negate;
+    Var x;
+    Func clamped, f;
+    clamped(x) = input(clamp(x, 0, input.width() - 1));
+    RDom r(-radius, 2*radius + 1);
+    f(x) = 0;
+    f(x) += clamped(x + r);
+    f(x) = select(negate, -f(x), f(x)) + cast<int>(weight * 4);
+    f.specialize_param_values(2);
+
+    Image<int> in(100);
+    for (int i = 0; i < 100; i++) {
+        in(i) = (i * 17) % 23;
+    }
+    input.set(in);
+
+    // Only the first two sets of values get their own versions. The
+    // other two share the generic code. Go around twice, to run the
+    // cached versions too.
+    const int radii[] = {1, 2, 3, 1};
+    const float weights[] = {0.5f, 0.0f, 1.25f, 0.25f};
+    const int expected_compiles[] = {1, 2, 3, 3, 3, 3, 3, 3};
+    int compiles_before = compiles();
+    for (int t = 0; t < 8; t++) {
+        int rad = radii[t % 4];
+        float w = weights[t % 4];
+        bool neg = (t % 4) == 1;
+        radius.set(rad);
+        weight.set(w);
+        negate.set(neg);
+        Image<int> out = f.realize(100);
+        for (int i = 0; i < 100; i++) {
+            int correct = 0;
+            for (int j = -rad; j <= rad; j++) {
+                int k = i + j;
+                if (k < 0) k = 0;
+                if (k > 99) k = 99;
+                correct += in(k);
+            }
+            if (neg) correct = -correct;
+            correct += (int)(w * 4);
+            if (out(i) != correct) {
+                printf("Radius %d: out(%d) = %d instead of %d\n", rad, i, out(i), correct);
+                return -1;
+            }
+        }
+        if (compiles() - compiles_before != expected_compiles[t]) {
+            printf("After realize %d, %d versions were compiled instead of %d\n",
+                   t, compiles() - compiles_before, expected_compiles[t]);
+            return -1;
+        }
+    }
+
+    // A value outside the Param's range isn't baked in, so the range
+    // check still fails.
+    {
+        Param<int> scale;
+        scale.set_range(0, 10);
+        Func g;
+        g(x) = x * scale;
+        g.specialize_param_values(4);
+        g.set_error_handler(&my_error_handler);
+
+        scale.set(3);
+        Image<int> out = g.realize(10);
+        if (error_occurred || out(5) != 15) {
+            printf("g(5) = %d instead of 15\n", out(5));
+            return -1;
+        }
+
+        scale.set(100);
+        g.realize(10);
+        if (!error_occurred) {
+            printf("There was supposed to be an error for an out-of-range Param\n");
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
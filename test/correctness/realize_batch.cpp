@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+using std::vector;
+
+// Check that realizing a batch gives every item its own inputs and
+// outputs.
+
+int main(int argc, char **argv) {
+    ImageParam input(Int(32), 2);
+    ImageParam weights(Int(32), 1);
+    Param<int> offset;
+    Var x, y;
+    Func f;
+    f(x, y) = input(x, y) * weights(0) + x + offset;
+    // A parallel loop nested inside the batch
+    f.parallel(y).vectorize(x, 4);
+
+    Image<int> w(1);
+    w(0) = 3;
+    weights.set(w);
+    offset.set(7);
+
+    const int n = 100;
+    vector<Buffer> outputs;
+    vector<vector<Buffer> > inputs;
+    vector<ImageParam> params;
+    params.push_back(input);
+    for (int i = 0; i < n; i++) {
+        // The items don't all have to be the same size
+        int size = 16 + (i % 4) * 8;
+        Image<int> in(size, size);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                in(x, y) = x * y + i;
+            }
+        }
+        inputs.push_back(vector<Buffer>(1, in));
+        outputs.push_back(Image<int>(size, size));
+    }
+
+    f.realize_batch(outputs, params, inputs);
+
+    for (int i = 0; i < n; i++) {
+        Image<int> out = outputs[i];
+        Image<int> in = inputs[i][0];
+        for (int y = 0; y < out.height(); y++) {
+            for (int x = 0; x < out.width(); x++) {
+                int correct = in(x, y) * 3 + x + 7;
+                if (out(x, y) != correct) {
+                    printf("Item %d: out(%d, %d) = %d instead of %d\n",
+                           i, x, y, out(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that a chain of compute_root stages gets one allocation per
+// realization, rather than one per stage.
+
+int malloc_count = 0;
+int free_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    malloc_count++;
+    void *orig = malloc(x+32);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free_count++;
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+
+    const int stages = 6;
+    Func f[stages];
+    f[0](x, y) = x + y;
+    for (int i = 1; i < stages; i++) {
+        f[i](x, y) = f[i-1](x, y) + f[i-1](x+1, y);
+        if (i < stages - 1) {
+            f[i].compute_root();
+        }
+    }
+    f[0].compute_root();
+
+    Func out = f[stages-1];
+    out.set_custom_allocator(my_malloc, my_free);
+
+    Image<int> result = out.realize(100, 100);
+
+    if (malloc_count != 1 || free_count != 1) {
+        printf("%d calls to malloc and %d calls to free instead of one of each\n",
+               malloc_count, free_count);
+        return -1;
+    }
+
+    for (int y = 0; y < result.height(); y++) {
+        for (int x = 0; x < result.width(); x++) {
+            // Each stage sums two neighbours, so the result is a
+            // binomially weighted sum of the first stage.
+            int correct = 0, weight = 1;
+            for (int k = 0; k < stages; k++) {
+                correct += weight * (x + k + y);
+                weight = weight * (stages - 1 - k) / (k + 1);
+            }
+            if (result(x, y) != correct) {
+                printf("result(%d, %d) = %d instead of %d\n", x, y, result(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
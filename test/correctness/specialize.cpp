@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that a Func with specialized schedules picks the right one at
+// runtime, and that they all compute the same thing.
+
+int par_for_calls = 0;
+
+// A parallel for loop runner that isn't actually parallel, and counts
+// how often it's used.
+int counting_par_for(void *ctx, int (*f)(void *, int, uint8_t *), int min, int extent, uint8_t *closure) {
+    par_for_calls++;
+    for (int i = min; i < min + extent; i++) {
+        f(ctx, i, closure);
+    }
+    return 0;
+}
+
+bool error_occurred = false;
+void my_error_handler(void *user_context, const char *msg) {
+    printf("Expected: %s\n", msg);
+    error_occurred = true;
+}
+
+int main(int argc, char **argv) {
+    ImageParam im(Int(32), 2);
+    Param<bool> use_threads;
+    Var x, y;
+    Func f, g, h;
+    // Two intermediates on the heap, so that each version of the
+    // pipeline allocates buffers with the same names.
+    g(x, y) = im(x, y) * 2;
+    h(x, y) = x;
+    f(x, y) = g(x, y) + h(x, y);
+    g.compute_root();
+    h.compute_root();
+
+    f.specialize(use_threads && im.stride(0) == 1).parallel(y);
+    f.specialize(im.width() % 8 == 0).vectorize(x, 8);
+    f.set_custom_do_par_for(counting_par_for);
+
+    const int widths[] = {20, 16, 20};
+    const bool threads[] = {true, false, false};
+    for (int t = 0; t < 3; t++) {
+        int w = widths[t];
+        Image<int> in(w, 10);
+        for (int y = 0; y < 10; y++) {
+            for (int x = 0; x < w; x++) {
+                in(x, y) = x * 3 + y * t;
+            }
+        }
+        im.set(in);
+        use_threads.set(threads[t]);
+        par_for_calls = 0;
+
+        Image<int> out = f.realize(w, 10);
+
+        for (int y = 0; y < 10; y++) {
+            for (int x = 0; x < w; x++) {
+                int correct = in(x, y) * 2 + x;
+                if (out(x, y) != correct) {
+                    printf("Test %d: out(%d, %d) = %d instead of %d\n", t, x, y, out(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+
+        // Only the first specialization has a parallel loop
+        if ((par_for_calls > 0) != threads[t]) {
+            printf("Test %d: the wrong version of f ran\n", t);
+            return -1;
+        }
+    }
+
+    // A specialization for a value outside a Param's range must still
+    // check the range.
+    {
+        Param<int> p;
+        p.set_range(0, 10);
+        Func k;
+        k(x) = x + p;
+        k.specialize(p == 100).vectorize(x, 4);
+        k.set_error_handler(&my_error_handler);
+
+        p.set(5);
+        Image<int> out = k.realize(8);
+        if (error_occurred || out(3) != 8) {
+            printf("k(3) = %d instead of 8\n", out(3));
+            return -1;
+        }
+
+        p.set(100);
+        k.realize(8);
+        if (!error_occurred) {
+            printf("There was supposed to be an error for an out-of-range Param\n");
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
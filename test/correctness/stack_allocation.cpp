@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Check that Funcs computed per tile go on the stack, even though
+// the tiles at the edges of the image are smaller.
+
+int malloc_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    malloc_count++;
+    void *orig = malloc(x+32);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+int check(Func f, int W, int H) {
+    Image<int> im = f.realize(W, H);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = (x-1)*y + (x+1)*y + x*(y-1) + x*(y+1);
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Var x, y, xo, yo, xi, yi;
+
+    // A small tile. The size of g is bounded by 10x10, so it should
+    // go on the stack automatically.
+    {
+        Func f, g;
+        g(x, y) = x*y;
+        f(x, y) = g(x-1, y) + g(x+1, y) + g(x, y-1) + g(x, y+1);
+        f.tile(x, y, xo, yo, xi, yi, 8, 8);
+        g.compute_at(f, xo);
+
+        f.set_custom_allocator(my_malloc, my_free);
+        malloc_count = 0;
+        if (check(f, 100, 100)) return -1;
+        if (malloc_count != 0) {
+            printf("%d calls to malloc for a small tile\n", malloc_count);
+            return -1;
+        }
+    }
+
+    // A large tile. g is 66x66, which is too big to go on the stack
+    // unless we ask.
+    {
+        Func f, g;
+        g(x, y) = x*y;
+        f(x, y) = g(x-1, y) + g(x+1, y) + g(x, y-1) + g(x, y+1);
+        f.tile(x, y, xo, yo, xi, yi, 64, 64);
+        g.compute_at(f, xo).store_in_stack();
+
+        f.set_custom_allocator(my_malloc, my_free);
+        malloc_count = 0;
+        if (check(f, 200, 200)) return -1;
+        if (malloc_count != 0) {
+            printf("%d calls to malloc for a large tile stored in the stack\n", malloc_count);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
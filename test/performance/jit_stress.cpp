@@ -14,20 +14,31 @@ int main(int argc, char **argv) {
     a.set(c);
 
 
-    double t1, t2;
-    t1 = currentTime();
-
-    for (int i = 0; i < 100; i++) {
-        Func f;
-        f(x) = a(x) + b(x);
-        f.realize(c);
-        assert(c(0) == (i+1)*17);
-    }    
-
-    t2 = currentTime();
-    int elapsed = (int)(10.0 * (t2-t1));
-
-    printf("%d us per jit compilation\n", elapsed);
+    // First compile every pipeline from scratch, then let
+    // structurally identical pipelines share machine code.
+    const char *labels[] = {"jit compilation", "jit compilation with reuse"};
+    int cache_sizes[] = {0, 32};
+    for (int j = 0; j < 2; j++) {
+        set_jit_module_cache_size(cache_sizes[j]);
+
+        double t1, t2;
+        t1 = currentTime();
+
+        for (int i = 0; i < 100; i++) {
+            Func f;
+            f(x) = a(x) + b(x);
+            f.realize(c);
+            assert(c(0) == (j*100+i+1)*17);
+        }
+
+        t2 = currentTime();
+        int elapsed = (int)(10.0 * (t2-t1));
+
+        printf("%d us per %s\n", elapsed, labels[j]);
+    }
+
+    JITModuleCacheStats stats = get_jit_module_cache_stats();
+    printf("%d pipelines compiled, %d reused\n", stats.misses, stats.hits);
 
     printf("Success!\n");
     return 0;
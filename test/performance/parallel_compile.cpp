@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Jit-compile a batch of independent pipelines one at a time, and
+// then all at once on background threads.
+
+Func make_pipeline(int k) {
+    Var x, y;
+    Func f, g, h;
+    g(x, y) = x*y + k;
+    h(x, y) = g(x-1, y) + g(x+1, y) + g(x, y-1) + g(x, y+1);
+    f(x, y) = h(x, y) * 2 + (h(x, y) / 3);
+    g.compute_root().vectorize(x, 4);
+    h.compute_at(f, y).vectorize(x, 4);
+    f.parallel(y).vectorize(x, 8);
+    return f;
+}
+
+int check(Func f, int k) {
+    Image<int> im = f.realize(32, 32);
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            int h = (x-1)*y + (x+1)*y + x*(y-1) + x*(y+1) + 4*k;
+            int correct = h * 2 + h / 3;
+            if (im(x, y) != correct) {
+                printf("Pipeline %d: im(%d, %d) = %d instead of %d\n",
+                       k, x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // Every pipeline gets compiled from scratch.
+    set_jit_module_cache_size(0);
+
+    const int n = 8;
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int expected = cores < n ? cores : n;
+
+    // Warm up llvm, and parse the runtime modules for this target.
+    make_pipeline(0).compile_jit();
+
+    Func serial[n], parallel[n];
+    for (int i = 0; i < n; i++) {
+        serial[i] = make_pipeline(i);
+        parallel[i] = make_pipeline(i);
+    }
+
+    double t1 = currentTime();
+    for (int i = 0; i < n; i++) {
+        serial[i].compile_jit();
+    }
+    double t2 = currentTime();
+    double serial_time = t2 - t1;
+
+    t1 = currentTime();
+    AsyncTask tasks[n];
+    for (int i = 0; i < n; i++) {
+        tasks[i] = parallel[i].compile_jit_async();
+    }
+    for (int i = 0; i < n; i++) {
+        tasks[i].wait();
+    }
+    t2 = currentTime();
+    double parallel_time = t2 - t1;
+
+    for (int i = 0; i < n; i++) {
+        if (check(serial[i], i) || check(parallel[i], i)) return -1;
+    }
+
+    double speedup = serial_time / parallel_time;
+    printf("Compiling %d pipelines: %f ms one at a time, %f ms at once on %d cores\n",
+           n, serial_time, parallel_time, cores);
+    printf("Speedup: %f\n", speedup);
+
+    if (speedup < 0.5 * expected) {
+        fprintf(stderr, "WARNING: Compiling on %d threads should be close to %dx faster\n",
+                n, expected);
+        return 0;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+#define W 256
+#define H 4000
+
+// Time a pipeline with many cheap parallel rows, and one with a
+// parallel loop nested inside another, using the given number of
+// threads.
+void run(int threads, double *flat_time, double *nested_time) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", threads);
+    setenv("HL_NUMTHREADS", buf, 1);
+
+    // All JIT modules share one thread pool. Shut it down so that it
+    // restarts with the new thread count the next time it's used.
+    Internal::shutdown_jit_thread_pool();
+
+    Var x, y, c;
+    Func f, g, h;
+    f(x, y) = cast<float>(x) * y + 1.0f;
+    f.parallel(y);
+
+    g(x, y, c) = sqrt(cast<float>(x + y + c));
+    h(x, y, c) = g(x, y, c) * 2;
+    g.compute_at(h, c).parallel(y);
+    h.parallel(c);
+
+    Image<float> out_f = f.realize(W, H);
+    Image<float> out_h = h.realize(W, 16, 64);
+
+    double t1 = currentTime();
+    for (int i = 0; i < 20; i++) {
+        f.realize(out_f);
+    }
+    double t2 = currentTime();
+    for (int i = 0; i < 20; i++) {
+        h.realize(out_h);
+    }
+    double t3 = currentTime();
+
+    *flat_time = (t2 - t1) / 20;
+    *nested_time = (t3 - t2) / 20;
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            float correct = (float)x * y + 1.0f;
+            if (out_f(x, y) != correct) {
+                printf("out_f(%d, %d) = %f instead of %f\n", x, y, out_f(x, y), correct);
+                exit(-1);
+            }
+        }
+    }
+
+    for (int c = 0; c < 64; c++) {
+        for (int y = 0; y < 16; y++) {
+            for (int x = 0; x < W; x++) {
+                float correct = sqrtf((float)(x + y + c)) * 2;
+                if (fabs(out_h(x, y, c) - correct) > 0.0001f * correct) {
+                    printf("out_h(%d, %d, %d) = %f instead of %f\n", x, y, c, out_h(x, y, c), correct);
+                    exit(-1);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const int max_threads = 16;
+    double flat[max_threads+1], nested[max_threads+1];
+
+    // This measures how the pool scales with the thread count. It
+    // doesn't compare against the old pool with a single lock, which
+    // is no longer in the tree.
+    printf("Speedups are relative to one thread of the current thread pool,\n"
+           "not to the old single-lock pool.\n");
+    printf("threads   flat (ms)   speedup   nested (ms)   speedup\n");
+    for (int t = 1; t <= max_threads; t *= 2) {
+        run(t, flat + t, nested + t);
+        printf("%7d %11.3f %9.2f %13.3f %9.2f\n", t,
+               flat[t], flat[1] / flat[t],
+               nested[t], nested[1] / nested[t]);
+    }
+
+    printf("Success!\n");
+    return 0;
+}
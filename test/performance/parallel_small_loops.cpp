@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Time a pipeline made of many small parallel stages, so that it
+// spends most of its time starting parallel for loops back to back,
+// with idle threads either sleeping straight away or spinning first.
+double run(const char *spin_count) {
+    setenv("HL_SPIN_COUNT", spin_count, 1);
+
+    // The spin count is read when the thread pool starts up.
+    Internal::shutdown_jit_thread_pool();
+
+    Var x, y;
+    const int stages = 8;
+    Func f[stages];
+    f[0](x, y) = x + y;
+    for (int i = 1; i < stages; i++) {
+        f[i](x, y) = f[i-1](x, y) * 3 + 1;
+    }
+    for (int i = 0; i < stages - 1; i++) {
+        f[i].compute_root().parallel(y);
+    }
+    f[stages-1].parallel(y);
+
+    Image<int> out = f[stages-1].realize(64, 16);
+
+    const int iterations = 1000;
+    double t1 = currentTime();
+    for (int i = 0; i < iterations; i++) {
+        f[stages-1].realize(out);
+    }
+    double t2 = currentTime();
+
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            int correct = x + y;
+            for (int i = 1; i < stages; i++) {
+                correct = correct * 3 + 1;
+            }
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), correct);
+                exit(-1);
+            }
+        }
+    }
+
+    // Microseconds per parallel for loop
+    return (t2 - t1) * 1000 / (iterations * stages);
+}
+
+int main(int argc, char **argv) {
+    double sleeping = run("0");
+    double spinning = run("256");
+
+    printf("Sleeping when idle: %f us per parallel for loop\n"
+           "Spinning when idle: %f us per parallel for loop\n",
+           sleeping, spinning);
+
+    // Allow a little noise.
+    if (spinning > sleeping * 1.1) {
+        printf("Spinning before going to sleep didn't help\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Compare a blur with its radius as a Param to a version specialized
+// to the radius it's used with.
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2);
+    Param<int> radius;
+    Param<float> scale;
+    Var x, y;
+    RDom r(-radius, 2*radius + 1);
+    Func clamped, blur_x, generic, specialized;
+    clamped(x, y) = input(clamp(x, 0, input.width() - 1), y);
+    blur_x(x, y) = sum(clamped(x + r, y)) * scale;
+    generic(x, y) = blur_x(x, y);
+    specialized(x, y) = blur_x(x, y);
+    generic.vectorize(x, 8);
+    specialized.vectorize(x, 8);
+    specialized.specialize_param_values(1);
+
+    const int size = 1024;
+    Image<float> in(size, size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            in(x, y) = (float)((x + y) % 13);
+        }
+    }
+    input.set(in);
+    radius.set(2);
+    scale.set(0.2f);
+
+    Image<float> out1(size, size), out2(size, size);
+
+    // Compile both first
+    generic.realize(out1);
+    specialized.realize(out2);
+
+    const int iters = 20;
+    double t1 = currentTime();
+    for (int i = 0; i < iters; i++) {
+        generic.realize(out1);
+    }
+    double t2 = currentTime();
+    for (int i = 0; i < iters; i++) {
+        specialized.realize(out2);
+    }
+    double t3 = currentTime();
+
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            if (out1(x, y) != out2(x, y)) {
+                printf("out(%d, %d) = %f specialized instead of %f\n",
+                       x, y, out2(x, y), out1(x, y));
+                return -1;
+            }
+        }
+    }
+
+    double generic_time = (t2 - t1) / iters;
+    double specialized_time = (t3 - t2) / iters;
+    printf("Generic: %f ms, specialized to the Param values: %f ms\n",
+           generic_time, specialized_time);
+
+    if (specialized_time > generic_time) {
+        fprintf(stderr, "WARNING: Code specialized to the Param values should be faster\n");
+        return 0;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
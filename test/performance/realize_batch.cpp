@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+using std::vector;
+
+// Compare realizing many small patches one at a time with realizing
+// them as one batch.
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2);
+    Var x, y;
+    Func clamped, blur_x, blur_y;
+    clamped(x, y) = input(clamp(x, 0, 63), clamp(y, 0, 63));
+    blur_x(x, y) = (clamped(x-1, y) + clamped(x, y) + clamped(x+1, y)) / 3;
+    blur_y(x, y) = (blur_x(x, y-1) + blur_x(x, y) + blur_x(x, y+1)) / 3;
+    blur_x.compute_at(blur_y, y).vectorize(x, 8);
+    blur_y.vectorize(x, 8);
+
+    const int n = 4000;
+    vector<ImageParam> params(1, input);
+    vector<vector<Buffer> > inputs;
+    vector<Buffer> outputs;
+    for (int i = 0; i < n; i++) {
+        Image<float> in(64, 64);
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                in(x, y) = (float)((x + y + i) % 17);
+            }
+        }
+        inputs.push_back(vector<Buffer>(1, in));
+        outputs.push_back(Image<float>(64, 64));
+    }
+
+    input.set(inputs[0][0]);
+    blur_y.compile_jit();
+
+    double t1 = currentTime();
+    for (int i = 0; i < n; i++) {
+        input.set(inputs[i][0]);
+        blur_y.realize(outputs[i]);
+    }
+    double t2 = currentTime();
+    double one_at_a_time = t2 - t1;
+
+    vector<Buffer> batch_outputs;
+    for (int i = 0; i < n; i++) {
+        batch_outputs.push_back(Image<float>(64, 64));
+    }
+
+    t1 = currentTime();
+    blur_y.realize_batch(batch_outputs, params, inputs);
+    t2 = currentTime();
+    double batched = t2 - t1;
+
+    for (int i = 0; i < n; i++) {
+        Image<float> a = outputs[i], b = batch_outputs[i];
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                if (a(x, y) != b(x, y)) {
+                    printf("Patch %d: (%d, %d) is %f in the batch instead of %f\n",
+                           i, x, y, b(x, y), a(x, y));
+                    return -1;
+                }
+            }
+        }
+    }
+
+    printf("%d 64x64 patches: %f ms one at a time, %f ms as a batch\n",
+           n, one_at_a_time, batched);
+
+    if (batched > one_at_a_time) {
+        fprintf(stderr, "WARNING: Realizing a batch should be faster\n");
+        return 0;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Measure the peak memory footprint of a long chain of compute_root
+// stages. Each stage only needs the one before it, so intermediates
+// that are dead can share their storage with later ones.
+
+size_t current_bytes = 0, peak_bytes = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    current_bytes += x;
+    if (current_bytes > peak_bytes) peak_bytes = current_bytes;
+    void *orig = malloc(x+48);
+    // Leave room for the original pointer and the size.
+    void *ptr = (void *)((((size_t)orig + 47) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = x;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    current_bytes -= ((size_t *)ptr)[-2];
+    free(((void**)ptr)[-1]);
+}
+
+const int stages = 30;
+const int W = 1024, H = 256;
+
+// Compile and run the chain, returning its peak footprint and the time
+// per realization. HL_DISABLE_STORAGE_SHARING is read when the
+// pipeline is compiled, which happens in the first realize.
+int run(bool share, size_t *peak, double *time) {
+    if (share) {
+        unsetenv("HL_DISABLE_STORAGE_SHARING");
+    } else {
+        setenv("HL_DISABLE_STORAGE_SHARING", "1", 1);
+    }
+
+    Var x, y;
+    Func f[stages];
+    f[0](x, y) = x + y;
+    for (int i = 1; i < stages; i++) {
+        f[i](x, y) = max(f[i-1](x, y), f[i-1](x+1, y));
+    }
+    for (int i = 0; i < stages - 1; i++) {
+        f[i].compute_root();
+    }
+
+    Func out = f[stages-1];
+    out.set_custom_allocator(my_malloc, my_free);
+
+    current_bytes = peak_bytes = 0;
+    Image<int> result = out.realize(W, H);
+
+    double t1 = currentTime();
+    for (int i = 0; i < 10; i++) {
+        out.realize(result);
+    }
+    double t2 = currentTime();
+
+    *peak = peak_bytes;
+    *time = (t2 - t1) / 10;
+
+    // Each stage takes the max of two neighbours in the one before.
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = x + y + stages - 1;
+            if (result(x, y) != correct) {
+                printf("result(%d, %d) = %d instead of %d\n", x, y, result(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t unshared_bytes, shared_bytes;
+    double unshared_time, shared_time;
+    if (run(false, &unshared_bytes, &unshared_time)) return -1;
+    if (run(true, &shared_bytes, &shared_time)) return -1;
+
+    printf("Peak footprint without sharing: %lu bytes (%f ms)\n"
+           "Peak footprint with sharing:    %lu bytes (%f ms)\n",
+           (unsigned long)unshared_bytes, unshared_time,
+           (unsigned long)shared_bytes, shared_time);
+
+    // Without sharing, every intermediate has its own buffer. With
+    // it, two intermediates are live at a time, so we should need a
+    // few stages worth of memory at most.
+    if (shared_bytes > unshared_bytes / 4) {
+        printf("Intermediates aren't sharing storage\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+HalideExtern_1(int, track_concurrency, int);
+
+int main(int argc, char **argv) {
+    Var x, y;
+
+    Func f;
+    f(x, y) = track_concurrency(y);
+
+    f.parallel(y);
+    f.compile_to_file("concurrency_limit", user_context_param());
+    return 0;
+}
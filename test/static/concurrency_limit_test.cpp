@@ -0,0 +1,64 @@
+#include <concurrency_limit.h>
+#include <../../include/HalideRuntime.h>
+#include <static_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+
+static volatile int active = 0, max_active = 0;
+
+// Called once per row of the output. Keeps track of how many rows are
+// being computed at once.
+extern "C" int track_concurrency(int y) {
+    int now = __sync_add_and_fetch(&active, 1);
+    int old_max = max_active;
+    while (old_max < now && !__sync_bool_compare_and_swap(&max_active, old_max, now)) {
+        old_max = max_active;
+    }
+    usleep(500);
+    __sync_fetch_and_sub(&active, 1);
+    return y;
+}
+
+int run(void *context) {
+    Image<int> output(1, 100);
+    max_active = 0;
+    concurrency_limit(context, output);
+    for (int y = 0; y < 100; y++) {
+        assert(output(0, y) == y);
+    }
+    return max_active;
+}
+
+int main(int argc, char **argv) {
+    setenv("HL_NUMTHREADS", "8", 1);
+
+    int a, b;
+    if (halide_set_concurrency_limit(&a, 2) != 0) {
+        printf("Concurrency limits not supported on this platform\n");
+        printf("Success!\n");
+        return 0;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int limited = run(&a);
+        int unlimited = run(&b);
+        printf("Limited to 2 threads: %d rows at once. Unlimited: %d rows at once.\n",
+               limited, unlimited);
+        if (limited > 2) {
+            printf("Concurrency limit was exceeded\n");
+            return -1;
+        }
+    }
+
+    // Raising the limit takes effect on the next call.
+    halide_set_concurrency_limit(&a, 4);
+    if (run(&a) > 4) {
+        printf("Concurrency limit was exceeded\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}